@@ -1,3 +1,7 @@
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
 #include "alloc.h"
 #include "log.h"
 
@@ -93,55 +97,447 @@ void HW_TEARDOWN(void) {
 }
 
 #define PAGE_SIZE 4096
-#define TOUCH_PAGES(ARENA)                          \
-  do {                                              \
-    for (size_t i = 0; i < bytes; i += PAGE_SIZE) { \
-      ((char *)ARENA->mem_start)[i] = 0;            \
-    }                                               \
+#define TOUCH_PAGES(START, BYTES)                     \
+  do {                                                \
+    for (size_t i = 0; i < (BYTES); i += PAGE_SIZE) { \
+      ((char *)(START))[i] = 0;                       \
+    }                                                 \
   } while(0)
 
+static size_t huge_round(size_t bytes) {
+  return (bytes + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+}
 
-MemoryArena *arena_init(size_t bytes, bool page_strat) {
+// explicit huge pages are taken from the pool at map time, so the arena
+// cannot grow past its initial size. NULL when the pool is too small
+static void *hugetlb_map(size_t bytes) {
+#ifdef MAP_HUGETLB
+  void *mem = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  return mem == MAP_FAILED ? NULL : mem;
+#else
+  (void) bytes;
+  return NULL;
+#endif
+}
+
+// the whole reservation is mapped once, pages are committed as used grows
+MemoryArena *arena_init(size_t bytes, page_strat_t page_strat) {
   MemoryArena *arena = mmap(NULL, sizeof(MemoryArena),
                             PROT_READ | PROT_WRITE,
                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
 
   if (arena == MAP_FAILED) PANIC_WITH(ARENA_INIT_MMAP_ARENA_FAIL);
 
-  arena->size = bytes;
   arena->used = 0;
-  arena->mem_start = mmap(NULL, bytes,
-                          PROT_READ | PROT_WRITE,
-                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-
-  if (arena->mem_start == NULL) PANIC_WITH(ARENA_INIT_MMAP_MEM_FAIL);
+  arena->strat = page_strat;
+  arena->mem_start = NULL;
+  if (page_strat & PAGE_HUGETLB) {
+    arena->size = arena->reserved = huge_round(bytes);
+    arena->mem_start = hugetlb_map(arena->size);
+    if (arena->mem_start == NULL) arena->strat |= PAGE_HUGE;
+  }
+  if (arena->mem_start == NULL) {
+    arena->strat &= ~PAGE_HUGETLB;
+    bool huge = arena->strat & PAGE_HUGE;
+    arena->size = huge ? huge_round(bytes) : vmem_page_round(bytes);
+    arena->reserved = arena->size > ARENA_RESERVE ? arena->size
+                                                  : ARENA_RESERVE;
+    arena->mem_start = huge ? vmem_reserve_huge(arena->reserved)
+                            : vmem_reserve(arena->reserved);
+    vmem_commit(arena->mem_start, arena->size);
+  }
   arena->mem_offset = arena->mem_start;
 
-  if (page_strat) TOUCH_PAGES(arena); // force physical pages
+  if (page_strat & PAGE_PHYSICALLY) {
+    vmem_touch(arena->mem_start, arena->size, page_strat & PAGE_PARALLEL);
+  }
   return arena;
 }
 
+// a locked arena that hits RLIMIT_MEMLOCK keeps going unlocked rather
+// than failing the allocation, arena_report shows which one it is. the
+// pages locked so far are unlocked too, half a locked arena helps nobody
+static void arena_commit_to(MemoryArena *arena, size_t size) {
+  char *fresh = (char *) arena->mem_start + arena->size;
+  vmem_commit(fresh, size - arena->size);
+  if (arena->strat & PAGE_PHYSICALLY) {
+    vmem_touch(fresh, size - arena->size, arena->strat & PAGE_PARALLEL);
+  }
+  if ((arena->strat & PAGE_LOCKED) && mlock(fresh, size - arena->size)) {
+    munlock(arena->mem_start, size);
+    arena->strat &= ~PAGE_LOCKED;
+  }
+  arena->size = size;
+}
+
+static void arena_grow(MemoryArena *arena, size_t need) {
+  if (need > arena->reserved) PANIC_WITH(ARENA_ALLOC_SIZE_OVERFLOW);
+  size_t size = arena->size ? arena->size : PAGE_SIZE;
+  while (size < need) size *= 2;
+  if (size > arena->reserved) size = arena->reserved;
+  arena_commit_to(arena, size);
+}
+
+#define ARENA_UNTAGGED "untagged"
+
+// tags are compared by pointer first, call sites pass string literals
+static ArenaTag *arena_tag(ArenaStats *st, const char *tag) {
+  for (size_t t = 0; t < st->tag_len; t++) {
+    if (st->tags[t].tag == tag) return &st->tags[t];
+  }
+  for (size_t t = 0; t < st->tag_len; t++) {
+    if (strcmp(st->tags[t].tag, tag) == 0) return &st->tags[t];
+  }
+  if (st->tag_len == ARENA_MAX_TAGS) return &st->tags[ARENA_MAX_TAGS - 1];
+  st->tags[st->tag_len] = (ArenaTag){ tag, 0, 0, 0 };
+  return &st->tags[st->tag_len++];
+}
+
+static void *arena_push(MemoryArena *arena, size_t size, size_t align,
+                        const char *tag) {
+  size_t start = (arena->used + align - 1) & ~(align - 1);
+  if (start + size > arena->size) arena_grow(arena, start + size);
+  arena->used = start + size;
+  arena->mem_offset = (uint8_t *)arena->mem_start + arena->used;
+
+  ArenaStats *st = &arena->stats;
+  st->allocs++;
+  if (arena->used > st->peak) st->peak = arena->used;
+  if (arena->used > st->high_water) st->high_water = arena->used;
+  ArenaTag *t = arena_tag(st, tag);
+  t->bytes += size;
+  t->allocs++;
+  if (t->bytes > t->peak) t->peak = t->bytes;
+  return (uint8_t *)arena->mem_start + start;
+}
+
+// arena_push rounds up with a mask, so align has to be a power of two
+void *arena_alloc_aligned(MemoryArena *arena, size_t size, size_t align) {
+  if (align == 0 || (align & (align - 1)) != 0) PANIC_WITH(ARENA_BAD_ALIGN);
+  return arena_push(arena, size, align, ARENA_UNTAGGED);
+}
+
+void *arena_alloc_tagged(MemoryArena *arena, size_t size, const char *tag) {
+  return arena_push(arena, size, ARENA_ALIGN, tag);
+}
+
 void *arena_alloc(MemoryArena *arena, size_t size) {
-  if (arena->used + size > arena->size) PANIC_WITH(ARENA_ALLOC_SIZE_OVERFLOW);
-  void *ptr = arena->mem_offset;
-  arena->mem_offset = (uint8_t *)arena->mem_offset + size;
-  arena->used += size;
-  return ptr;
+  return arena_push(arena, size, ARENA_ALIGN, ARENA_UNTAGGED);
+}
+
+ArenaMarker arena_mark(MemoryArena *arena) { return arena->used; }
+
+// drops everything allocated after the marker, pages stay committed
+void arena_release(MemoryArena *arena, ArenaMarker marker) {
+  if (marker > arena->used) return;
+  arena->used = marker;
+  arena->mem_offset = (uint8_t *)arena->mem_start + marker;
 }
 
+// tag bytes only count allocations, arena_release does not give them back
 void arena_reset(MemoryArena *arena) {
+  ArenaStats *st = &arena->stats;
+  st->window[st->resets++ % ARENA_WINDOW] = st->peak;
+  st->last_peak = st->peak;
+  st->peak = 0;
+  st->allocs = 0;
+  for (size_t t = 0; t < st->tag_len; t++) {
+    st->tags[t].bytes = 0;
+    st->tags[t].allocs = 0;
+  }
   arena->used = 0;
   arena->mem_offset = arena->mem_start;
 }
 
 void arena_free(MemoryArena *arena) {
-  if (arena->mem_start != NULL) munmap(arena->mem_start, arena->size);
-  arena->mem_start = NULL;
-  arena->size = 0;
-  arena->used = 0;
-  if (arena != NULL) munmap(arena, sizeof(MemoryArena));
-  arena = NULL;
+  if (arena == NULL) return;
+  vmem_release(arena->mem_start, arena->reserved);
+  munmap(arena, sizeof(MemoryArena));
+}
+
+// commits ahead of the rolling high water mark plus headroom so a cycle
+// never has to grow mid-step, and hands pages back once the window has
+// stayed under half the committed size. best called right after a reset
+void arena_autosize(MemoryArena *arena, double headroom) {
+  if (arena->strat & PAGE_HUGETLB) return;
+  ArenaStats *st = &arena->stats;
+  size_t hw = st->peak > arena->used ? st->peak : arena->used;
+  for (size_t w = 0; w < ARENA_WINDOW; w++) {
+    if (st->window[w] > hw) hw = st->window[w];
+  }
+  size_t gran = (arena->strat & PAGE_HUGE) ? HUGE_PAGE_SIZE : PAGE_SIZE;
+  size_t target = (size_t) ((double) hw * (1.0 + headroom));
+  target = (target + gran - 1) & ~(gran - 1);
+  if (target < gran) target = gran;
+  if (target > arena->reserved) target = arena->reserved;
+
+  if (target > arena->size) {
+    arena_commit_to(arena, target);
+  } else if (target < arena->size / 2 && st->resets >= ARENA_WINDOW) {
+    char *spare = (char *) arena->mem_start + target;
+    if (arena->strat & PAGE_LOCKED) munlock(spare, arena->size - target);
+    vmem_decommit(spare, arena->size - target);
+    arena->size = target;
+  }
+}
+
+void arena_report(MemoryArena *arena, const char *name) {
+  ArenaStats *st = &arena->stats;
+  printf("%s: %zu Kb used, %zu Kb committed%s, %zu Kb reserved\n", name,
+         arena->used / 1024, arena->size / 1024,
+         (arena->strat & PAGE_LOCKED) ? " and locked" : "",
+         arena->reserved / 1024);
+  printf("  last peak %zu Kb, high water %zu Kb, %zu allocs, %zu resets\n",
+         st->last_peak / 1024, st->high_water / 1024, st->allocs,
+         st->resets);
+  for (size_t t = 0; t < st->tag_len; t++) {
+    printf("  %-20s %8zu b now, %8zu b peak, %6zu allocs\n",
+           st->tags[t].tag, st->tags[t].bytes, st->tags[t].peak,
+           st->tags[t].allocs);
+  }
+}
+
+// pins the committed pages in memory, and every page committed later on,
+// so the arena never page faults. false when the lock is not permitted
+bool arena_lock(MemoryArena *arena) {
+  if (mlock(arena->mem_start, arena->size) != 0) return false;
+  arena->strat |= PAGE_LOCKED;
+  return true;
+}
+
+size_t vmem_page_round(size_t bytes) {
+  return (bytes + PAGE_SIZE - 1) & ~(size_t)(PAGE_SIZE - 1);
+}
+
+void *vmem_reserve(size_t bytes) {
+  void *mem = mmap(NULL, vmem_page_round(bytes), PROT_NONE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (mem == MAP_FAILED) PANIC_WITH(VMEM_RESERVE_FAIL);
+  return mem;
+}
+
+void vmem_commit(void *addr, size_t bytes) {
+  if (mprotect(addr, vmem_page_round(bytes), PROT_READ | PROT_WRITE) != 0) {
+    PANIC_WITH(VMEM_COMMIT_FAIL);
+  }
+}
+
+// the range reads as zero and holds no memory until committed again
+void vmem_decommit(void *addr, size_t bytes) {
+  if (madvise(addr, vmem_page_round(bytes), MADV_DONTNEED) != 0) {
+    PANIC_WITH(VMEM_DECOMMIT_FAIL);
+  }
+  if (mprotect(addr, vmem_page_round(bytes), PROT_NONE) != 0) {
+    PANIC_WITH(VMEM_COMMIT_FAIL);
+  }
+}
+
+void vmem_release(void *addr, size_t bytes) {
+  if (addr != NULL) munmap(addr, vmem_page_round(bytes));
+}
+
+// over-reserves by one huge page and trims, so the start is 2 MB aligned
+// and the kernel can back every aligned 2 MB run with a single tlb entry
+void *vmem_reserve_huge(size_t bytes) {
+  size_t len = huge_round(bytes);
+  char *mem = vmem_reserve(len + HUGE_PAGE_SIZE);
+  char *start = (char *) huge_round((size_t) mem);
+  size_t head = (size_t) (start - mem);
+  if (head > 0) munmap(mem, head);
+  munmap(start + len, HUGE_PAGE_SIZE - head);
+#ifdef MADV_HUGEPAGE
+  madvise(start, len, MADV_HUGEPAGE); // advisory, thp may be disabled
+#endif
+  return start;
+}
+
+typedef struct {
+  char *start;
+  size_t bytes;
+} TouchSlice;
+
+static void *touch_slice(void *arg) {
+  TouchSlice *slice = (TouchSlice *) arg;
+  TOUCH_PAGES(slice->start, slice->bytes);
+  return NULL;
+}
+
+// a large range is faulted in contiguous slices by short lived threads,
+// which only spreads the time spent in the fault handler. the threads are
+// not pinned, so this says nothing about which node backs a slice. the
+// body store is faulted by the job workers instead, see sim_prefault
+void vmem_touch(void *addr, size_t bytes, bool parallel) {
+  size_t workers = 1;
+  if (parallel && bytes >= PAGE_PARALLEL_MIN) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    workers = cpus > 1 ? (size_t) cpus : 1;
+    if (workers > PAGE_MAX_TOUCHERS) workers = PAGE_MAX_TOUCHERS;
+  }
+  if (workers == 1) {
+    TOUCH_PAGES(addr, bytes);
+    return;
+  }
+  pthread_t tids[PAGE_MAX_TOUCHERS];
+  TouchSlice slices[PAGE_MAX_TOUCHERS];
+  bool spawned[PAGE_MAX_TOUCHERS] = {0};
+  size_t chunk = vmem_page_round((bytes + workers - 1) / workers);
+  for (size_t w = 0; w < workers && w * chunk < bytes; w++) {
+    size_t off = w * chunk;
+    slices[w] = (TouchSlice){ (char *) addr + off,
+                              bytes - off < chunk ? bytes - off : chunk };
+    spawned[w] = pthread_create(&tids[w], NULL, touch_slice, &slices[w]) == 0;
+    if (!spawned[w]) touch_slice(&slices[w]);
+  }
+  for (size_t w = 0; w < workers; w++) {
+    if (spawned[w]) pthread_join(tids[w], NULL);
+  }
+}
+
+#ifdef ALLOC_TRACE
+#include <execinfo.h>
+#include <sys/syscall.h>
+
+extern void *__libc_malloc(size_t);
+extern void *__libc_calloc(size_t, size_t);
+extern void *__libc_realloc(void *, size_t);
+extern void *__libc_memalign(size_t, size_t);
+extern void __libc_free(void *);
+
+#ifdef ALLOC_TRACE_STRICT
+#define TRACE_STRICT_DEFAULT true
+#else
+#define TRACE_STRICT_DEFAULT false
+#endif
+
+// sites live in a fixed open addressed table, the tracer itself must
+// never allocate. everything is atomic since workers allocate too
+typedef struct {
+  void *site;
+  size_t allocs;
+  size_t bytes;
+  size_t steady;  // allocations after warm-up
+} TraceSite;
+
+static TraceSite TRACE_SITES[ALLOC_TRACE_SITES];
+static size_t TRACE_FRAMES = 0;
+static size_t TRACE_FRAME_ALLOCS = 0;
+static size_t TRACE_FRAME_MAX = 0;
+static size_t TRACE_TOTAL = 0;
+static size_t TRACE_STEADY = 0;
+static size_t TRACE_FREES = 0;
+static bool TRACE_STRICT = TRACE_STRICT_DEFAULT;
+static _Thread_local bool TRACE_BUSY = false;
+
+#define TRACE_ADD(VAR, N) __atomic_add_fetch(&(VAR), (N), __ATOMIC_RELAXED)
+#define TRACE_GET(VAR)    __atomic_load_n(&(VAR), __ATOMIC_RELAXED)
+
+static TraceSite *trace_site(void *site) {
+  size_t h = ((size_t) site >> 4) * 0x9E3779B97F4A7C15ull;
+  for (size_t k = 0; k < ALLOC_TRACE_SITES; k++) {
+    TraceSite *s = &TRACE_SITES[(h + k) % ALLOC_TRACE_SITES];
+    void *cur = __atomic_load_n(&s->site, __ATOMIC_ACQUIRE);
+    if (cur == site) return s;
+    if (cur == NULL) {
+      void *none = NULL;
+      if (__atomic_compare_exchange_n(&s->site, &none, site, false,
+                                      __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+          || none == site) return s;
+    }
+  }
+  return NULL; // table full, only the totals see this one
+}
+
+// snprintf into a stack buffer and write(2), stdio could allocate
+static void trace_complain(void *site, size_t bytes, const char *kind) {
+  char buf[128];
+  int len = snprintf(buf, sizeof(buf),
+                     "[ALLOC] frame %zu: %s of %zu bytes from ",
+                     TRACE_GET(TRACE_FRAMES), kind, bytes);
+  if (len > 0) write(STDERR_FILENO, buf, (size_t) len);
+  backtrace_symbols_fd(&site, 1, STDERR_FILENO);
+}
+
+static void trace_record(void *site, size_t bytes, const char *kind) {
+  if (TRACE_BUSY) return;
+  TRACE_BUSY = true;
+  TRACE_ADD(TRACE_TOTAL, 1);
+  TRACE_ADD(TRACE_FRAME_ALLOCS, 1);
+  TraceSite *s = trace_site(site);
+  if (s != NULL) {
+    TRACE_ADD(s->allocs, 1);
+    TRACE_ADD(s->bytes, bytes);
+  }
+  if (TRACE_GET(TRACE_FRAMES) >= ALLOC_TRACE_WARMUP) {
+    TRACE_ADD(TRACE_STEADY, 1);
+    if (s != NULL) TRACE_ADD(s->steady, 1);
+    if (TRACE_STRICT) trace_complain(site, bytes, kind);
+  }
+  TRACE_BUSY = false;
+}
+
+#define CALLER __builtin_return_address(0)
+
+void *malloc(size_t n) {
+  trace_record(CALLER, n, "malloc");
+  return __libc_malloc(n);
+}
+
+void *calloc(size_t count, size_t n) {
+  trace_record(CALLER, count * n, "calloc");
+  return __libc_calloc(count, n);
+}
+
+void *realloc(void *ptr, size_t n) {
+  trace_record(CALLER, n, "realloc");
+  return __libc_realloc(ptr, n);
+}
+
+void *aligned_alloc(size_t align, size_t n) {
+  trace_record(CALLER, n, "aligned_alloc");
+  return __libc_memalign(align, n);
+}
+
+void free(void *ptr) {
+  if (ptr != NULL) TRACE_ADD(TRACE_FREES, 1);
+  __libc_free(ptr);
+}
+
+// only catches calls through the plt, libc's internal mmaps stay hidden
+void *mmap(void *addr, size_t len, int prot, int flags, int fd, off_t off) {
+  trace_record(CALLER, len, "mmap");
+  return (void *) syscall(SYS_mmap, addr, len, prot, flags, fd, off);
+}
+
+void alloc_trace_frame_end(void) {
+  size_t n = __atomic_exchange_n(&TRACE_FRAME_ALLOCS, 0, __ATOMIC_RELAXED);
+  if (TRACE_GET(TRACE_FRAMES) >= ALLOC_TRACE_WARMUP && n > TRACE_FRAME_MAX) {
+    TRACE_FRAME_MAX = n;
+  }
+  TRACE_ADD(TRACE_FRAMES, 1);
+}
+
+void alloc_trace_strict(bool strict) { TRACE_STRICT = strict; }
+
+void alloc_trace_report(void) {
+  TRACE_BUSY = true;
+  printf("allocation trace over %zu frames (%d warm-up)\n",
+         TRACE_FRAMES, ALLOC_TRACE_WARMUP);
+  printf("  %zu allocations, %zu frees, %zu in steady state, "
+         "worst steady frame %zu\n",
+         TRACE_TOTAL, TRACE_FREES, TRACE_STEADY, TRACE_FRAME_MAX);
+  fflush(stdout);
+  for (size_t k = 0; k < ALLOC_TRACE_SITES; k++) {
+    TraceSite *s = &TRACE_SITES[k];
+    if (s->site == NULL || s->steady == 0) continue;
+    printf("  %8zu steady, %8zu total, %10zu bytes  ", s->steady, s->allocs,
+           s->bytes);
+    fflush(stdout);
+    backtrace_symbols_fd(&s->site, 1, STDOUT_FILENO);
+  }
+  TRACE_BUSY = false;
 }
+#endif // ALLOC_TRACE
 
 #if 0 // deprecated
 MemoryArena *arena_init(size_t bytes, bool page_strat) {
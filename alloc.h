@@ -7,8 +7,18 @@
 #include <stdbool.h>
 #include <sys/mman.h>
 
-#define PAGE_VIRTUALLY  false
-#define PAGE_PHYSICALLY true
+// page strategies, or'd together
+typedef unsigned page_strat_t;
+#define PAGE_VIRTUALLY  0u
+#define PAGE_PHYSICALLY 1u  // pre-fault pages as soon as they are committed
+#define PAGE_HUGE       2u  // 2 MB aligned and advised for transparent huge
+#define PAGE_HUGETLB    4u  // explicit hugetlbfs pages, fixed size, else HUGE
+#define PAGE_PARALLEL   8u  // pre-faulting is split across threads
+#define PAGE_LOCKED    16u  // committed pages are mlocked, see arena_lock
+
+#define HUGE_PAGE_SIZE     (1ull << 21)
+#define PAGE_PARALLEL_MIN  (1ull << 26) // below this one thread is faster
+#define PAGE_MAX_TOUCHERS  16
 
 typedef enum {
   ID_STD_PTR,
@@ -33,17 +43,82 @@ void HW_INIT(void);
 void HW_REGISTER(res_id_t, void *);
 void HW_TEARDOWN(void);
 
+#define ARENA_RESERVE (1ull << 32) // address space per arena, 4 GB
+#define ARENA_ALIGN   16          // default, enough for any scalar type
+
+#define ARENA_MAX_TAGS 16
+#define ARENA_WINDOW   240  // resets the autosize high water mark spans
+
+typedef struct {
+  const char *tag;
+  size_t bytes;     // since the last reset
+  size_t peak;      // most bytes seen in any single reset cycle
+  size_t allocs;    // since the last reset
+} ArenaTag;
+
+// a cycle runs from one arena_reset to the next, for the frame arena
+// that is one tree rebuild
 typedef struct {
-  size_t size;
+  size_t allocs;      // since the last reset
+  size_t peak;        // highest used since the last reset
+  size_t last_peak;   // peak of the previous cycle
+  size_t high_water;  // highest used ever
+  size_t resets;
+  size_t window[ARENA_WINDOW]; // peaks of the last ARENA_WINDOW cycles
+  ArenaTag tags[ARENA_MAX_TAGS];
+  size_t tag_len;
+} ArenaStats;
+
+typedef struct {
+  size_t size;      // committed bytes, grows on demand up to reserved
+  size_t reserved;
   size_t used;
+  page_strat_t strat;
   void *mem_start;
   void *mem_offset;
+  ArenaStats stats;
 } MemoryArena;
 
-MemoryArena *arena_init(size_t, bool);
+typedef size_t ArenaMarker;
+
+MemoryArena *arena_init(size_t, page_strat_t);
 void *arena_alloc(MemoryArena *, size_t);
+void *arena_alloc_aligned(MemoryArena *, size_t, size_t);
+void *arena_alloc_tagged(MemoryArena *, size_t, const char *);
+ArenaMarker arena_mark(MemoryArena *);
+void arena_release(MemoryArena *, ArenaMarker);
 void arena_reset(MemoryArena *);
 void arena_free(MemoryArena *);
+void arena_autosize(MemoryArena *, double);
+void arena_report(MemoryArena *, const char *);
+bool arena_lock(MemoryArena *);
+
+// address space is reserved up front and backed with pages on demand,
+// so anything carved from a reservation never moves
+void *vmem_reserve(size_t);
+void *vmem_reserve_huge(size_t);
+void vmem_commit(void *, size_t);
+void vmem_decommit(void *, size_t);
+void vmem_release(void *, size_t);
+void vmem_touch(void *, size_t, bool);
+size_t vmem_page_round(size_t);
+
+// build with -DALLOC_TRACE to interpose malloc/calloc/realloc/free and
+// mmap. allocations are counted per frame and per call site; with
+// -DALLOC_TRACE_STRICT every allocation after the warm-up frames is
+// reported on stderr as it happens
+#define ALLOC_TRACE_WARMUP 120
+#define ALLOC_TRACE_SITES  512
 
+#ifdef ALLOC_TRACE
+void alloc_trace_frame_end(void);
+void alloc_trace_strict(bool);
+void alloc_trace_report(void);
+#define TRACE_FRAME_END() alloc_trace_frame_end()
+#define TRACE_REPORT()    alloc_trace_report()
+#else
+#define TRACE_FRAME_END() do {} while(0)
+#define TRACE_REPORT()    do {} while(0)
+#endif
 
 #endif // ALLOC_H_
@@ -0,0 +1,267 @@
+#include "bvh.h"
+#include "log.h"
+
+static AABB tight_box(Bodies *b, uint32_t body) {
+  double R = b->R[body];
+  return (AABB){ { b->x[body] - R, b->y[body] - R },
+                 { b->x[body] + R, b->y[body] + R } };
+}
+
+static AABB fat_box(Bodies *b, uint32_t body) {
+  double pad = fmax(BVH_FAT_RATIO * b->R[body], BVH_FAT_MIN);
+  AABB box = tight_box(b, body);
+  return (AABB){ { box.min.x - pad, box.min.y - pad },
+                 { box.max.x + pad, box.max.y + pad } };
+}
+
+static inline bool is_leaf(BVHNode *node) { return node->left == BVH_NULL; }
+
+static uint32_t node_alloc(DynamicTree *t) {
+  if (t->free_list == BVH_NULL) {
+    size_t old_cap = t->node_cap;
+    t->node_cap = old_cap ? 2 * old_cap : 256;
+    t->nodes = realloc(t->nodes, t->node_cap * sizeof(BVHNode));
+    if (t->nodes == NULL) PANIC_WITH(BVH_ALLOC_FAIL);
+    for (size_t n = old_cap; n < t->node_cap; n++) {
+      t->nodes[n].parent = n + 1 < t->node_cap ? (uint32_t)(n + 1) : BVH_NULL;
+      t->nodes[n].height = -1;
+    }
+    t->free_list = (uint32_t) old_cap;
+  }
+  uint32_t id = t->free_list;
+  t->free_list = t->nodes[id].parent;
+  t->nodes[id] = (BVHNode){
+    .parent = BVH_NULL, .left = BVH_NULL, .right = BVH_NULL,
+    .height = 0, .body = BVH_NULL,
+  };
+  return id;
+}
+
+static void node_release(DynamicTree *t, uint32_t id) {
+  t->nodes[id].parent = t->free_list;
+  t->nodes[id].height = -1;
+  t->free_list = id;
+}
+
+static void node_refit(DynamicTree *t, uint32_t id) {
+  BVHNode *n = &t->nodes[id];
+  BVHNode *l = &t->nodes[n->left], *r = &t->nodes[n->right];
+  n->box = aabb_union(l->box, r->box);
+  n->height = 1 + (l->height > r->height ? l->height : r->height);
+}
+
+static void replace_child(DynamicTree *t, uint32_t parent,
+                          uint32_t old_child, uint32_t new_child)
+{
+  if (parent == BVH_NULL) { t->root = new_child; return; }
+  if (t->nodes[parent].left == old_child) t->nodes[parent].left = new_child;
+  else t->nodes[parent].right = new_child;
+}
+
+// single AVL style rotation lifting the taller grandchild, returns the
+// index now occupying a's place
+static uint32_t node_balance(DynamicTree *t, uint32_t a) {
+  BVHNode *nodes = t->nodes;
+  if (is_leaf(&nodes[a]) || nodes[a].height < 2) return a;
+  uint32_t b = nodes[a].left, c = nodes[a].right;
+  int32_t balance = nodes[c].height - nodes[b].height;
+  if (balance >= -1 && balance <= 1) return a;
+
+  // up is the taller child, keep is the sibling that stays under a
+  bool right_heavy = balance > 1;
+  uint32_t up = right_heavy ? c : b;
+  uint32_t f = nodes[up].left, g = nodes[up].right;
+
+  nodes[up].left = a;
+  nodes[up].parent = nodes[a].parent;
+  nodes[a].parent = up;
+  replace_child(t, nodes[up].parent, a, up);
+
+  uint32_t tall  = nodes[f].height > nodes[g].height ? f : g;
+  uint32_t small = tall == f ? g : f;
+  nodes[up].right = tall;
+  if (right_heavy) nodes[a].right = small;
+  else nodes[a].left = small;
+  nodes[small].parent = a;
+  node_refit(t, a);
+  node_refit(t, up);
+  return up;
+}
+
+static void refit_upwards(DynamicTree *t, uint32_t id) {
+  while (id != BVH_NULL) {
+    id = node_balance(t, id);
+    node_refit(t, id);
+    id = t->nodes[id].parent;
+  }
+}
+
+// descend towards the sibling that minimises added perimeter, counting
+// the growth forced on every ancestor along the way
+static void leaf_insert(DynamicTree *t, uint32_t leaf) {
+  if (t->root == BVH_NULL) {
+    t->root = leaf;
+    t->nodes[leaf].parent = BVH_NULL;
+    return;
+  }
+  AABB box = t->nodes[leaf].box;
+  uint32_t id = t->root;
+  while (!is_leaf(&t->nodes[id])) {
+    BVHNode *n = &t->nodes[id];
+    double area = aabb_perimeter(n->box);
+    double combined = aabb_perimeter(aabb_union(n->box, box));
+    double cost = 2.0 * combined;
+    double inherited = 2.0 * (combined - area);
+
+    double child_cost[2];
+    uint32_t child[2] = { n->left, n->right };
+    for (size_t k = 0; k < 2; k++) {
+      BVHNode *c = &t->nodes[child[k]];
+      double grown = aabb_perimeter(aabb_union(c->box, box));
+      child_cost[k] = (is_leaf(c) ? grown : grown - aabb_perimeter(c->box))
+                    + inherited;
+    }
+    if (cost < child_cost[0] && cost < child_cost[1]) break;
+    id = child_cost[0] < child_cost[1] ? child[0] : child[1];
+  }
+
+  uint32_t sibling = id;
+  uint32_t old_parent = t->nodes[sibling].parent;
+  uint32_t parent = node_alloc(t);
+  BVHNode *nodes = t->nodes;
+  nodes[parent].parent = old_parent;
+  nodes[parent].left = sibling;
+  nodes[parent].right = leaf;
+  nodes[sibling].parent = parent;
+  nodes[leaf].parent = parent;
+  replace_child(t, old_parent, sibling, parent);
+  refit_upwards(t, parent);
+}
+
+static void leaf_remove(DynamicTree *t, uint32_t leaf) {
+  if (leaf == t->root) { t->root = BVH_NULL; return; }
+  BVHNode *nodes = t->nodes;
+  uint32_t parent = nodes[leaf].parent;
+  uint32_t grand = nodes[parent].parent;
+  uint32_t sibling =
+    nodes[parent].left == leaf ? nodes[parent].right : nodes[parent].left;
+
+  replace_child(t, grand, parent, sibling);
+  nodes[sibling].parent = grand;
+  node_release(t, parent);
+  refit_upwards(t, grand);
+}
+
+DynamicTree *bvh_init(Bodies *bodies) {
+  DynamicTree *t = (DynamicTree *) calloc(1, sizeof(DynamicTree));
+  if (t == NULL) PANIC_WITH(BVH_ALLOC_FAIL);
+  t->bodies = bodies;
+  t->root = BVH_NULL;
+  t->free_list = BVH_NULL;
+  return t;
+}
+
+// bodies are added in index order, the next one is body num_bodies
+void bvh_add(DynamicTree *t, uint32_t body) {
+  if (t->num_bodies == t->body_cap) {
+    t->body_cap = t->body_cap ? 2 * t->body_cap : 256;
+    t->leaf_of = realloc(t->leaf_of, t->body_cap * sizeof(uint32_t));
+    if (!t->leaf_of) PANIC_WITH(BVH_ALLOC_FAIL);
+  }
+  uint32_t leaf = node_alloc(t);
+  t->nodes[leaf].box = fat_box(t->bodies, body);
+  t->nodes[leaf].body = body;
+  t->leaf_of[t->num_bodies++] = leaf;
+  leaf_insert(t, leaf);
+}
+
+size_t bvh_update(DynamicTree *t) {
+  size_t moved = 0;
+  for (size_t n = 0; n < t->num_bodies; n++) {
+    uint32_t leaf = t->leaf_of[n];
+    uint32_t body = (uint32_t) n;
+    if (aabb_contains(t->nodes[leaf].box, tight_box(t->bodies, body))) {
+      continue;
+    }
+    leaf_remove(t, leaf);
+    t->nodes[leaf].box = fat_box(t->bodies, body);
+    leaf_insert(t, leaf);
+    moved++;
+  }
+  return moved;
+}
+
+static void leaf_free(DynamicTree *t, uint32_t leaf) {
+  leaf_remove(t, leaf);
+  node_release(t, leaf);
+}
+
+// follows entities_compact: a leaf from the tail past len is dropped or
+// moves to the hole below it, whose own leaf goes
+void bvh_compact(DynamicTree *t, const uint32_t *to, size_t len) {
+  for (size_t k = len; k < t->num_bodies; k++) {
+    uint32_t j = to[k];
+    if (j == BODY_REMOVED) {
+      leaf_free(t, t->leaf_of[k]);
+      continue;
+    }
+    leaf_free(t, t->leaf_of[j]);
+    t->leaf_of[j] = t->leaf_of[k];
+    t->nodes[t->leaf_of[j]].body = j;
+  }
+  t->num_bodies = len;
+}
+
+// every node goes back on the free list, capacity is kept
+void bvh_clear(DynamicTree *t) {
+  for (size_t n = 0; n < t->node_cap; n++) {
+    t->nodes[n].parent = n + 1 < t->node_cap ? (uint32_t)(n + 1) : BVH_NULL;
+    t->nodes[n].height = -1;
+  }
+  t->root = BVH_NULL;
+  t->free_list = t->node_cap ? 0 : BVH_NULL;
+  t->num_bodies = 0;
+}
+
+void bvh_free(DynamicTree *t) {
+  if (t == NULL) return;
+  free(t->nodes);
+  free(t->leaf_of);
+  free(t->stack);
+  free(t);
+}
+
+static void stack_push(DynamicTree *t, size_t *top, uint32_t id) {
+  if (*top == t->stack_cap) {
+    t->stack_cap = t->stack_cap ? 2 * t->stack_cap : 64;
+    t->stack = realloc(t->stack, t->stack_cap * sizeof(uint32_t));
+    if (t->stack == NULL) PANIC_WITH(BVH_ALLOC_FAIL);
+  }
+  t->stack[(*top)++] = id;
+}
+
+// touching bodies overlap each other's fat boxes from both sides, so
+// keeping only p_i < p_j drops duplicates without losing contacts
+void bvh_for_each_pair(DynamicTree *t, pair_fn fn, void *ctx) {
+  if (t->root == BVH_NULL) return;
+  for (size_t n = 0; n < t->num_bodies; n++) {
+    uint32_t p_i = (uint32_t) n;
+    AABB box = tight_box(t->bodies, p_i);
+    size_t top = 0;
+    stack_push(t, &top, t->root);
+    while (top > 0) {
+      BVHNode *node = &t->nodes[t->stack[--top]];
+      if (!aabb_overlap(node->box, box)) continue;
+      if (is_leaf(node)) {
+        if (p_i < node->body) fn(t->bodies, p_i, node->body, ctx);
+        continue;
+      }
+      stack_push(t, &top, node->left);
+      stack_push(t, &top, node->right);
+    }
+  }
+}
+
+void bvh_apply_collisions(DynamicTree *t) {
+  bvh_for_each_pair(t, pair_impulsive_collision, NULL);
+}
@@ -0,0 +1,68 @@
+#ifndef BVH_H_
+#define BVH_H_
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "physics.h"
+
+#define BVH_NULL      UINT32_MAX
+#define BVH_FAT_RATIO 0.25  // leaf boxes are grown by this fraction of R
+#define BVH_FAT_MIN   1.0   // and never by less than this
+
+typedef struct { vec2 min, max; } AABB;
+
+typedef struct {
+  AABB box;          // fattened for leaves, union of children otherwise
+  uint32_t parent;   // next free node while on the free list
+  uint32_t left, right;
+  int32_t height;    // 0 for leaves, -1 while free
+  uint32_t body;     // BVH_NULL unless a leaf
+} BVHNode;
+
+// dynamic bounding volume tree with surface area heuristic insertion,
+// bodies only get reinserted once their tight box leaves the fat one
+typedef struct {
+  uint32_t root, free_list;
+  size_t node_cap;
+  BVHNode *nodes;
+  size_t num_bodies, body_cap;
+  Bodies *bodies;
+  uint32_t *leaf_of;
+  size_t stack_cap;
+  uint32_t *stack;
+} DynamicTree;
+
+static inline bool aabb_overlap(AABB a, AABB b) {
+  return a.min.x <= b.max.x && b.min.x <= a.max.x
+      && a.min.y <= b.max.y && b.min.y <= a.max.y;
+}
+
+static inline bool aabb_contains(AABB outer, AABB inner) {
+  return outer.min.x <= inner.min.x && inner.max.x <= outer.max.x
+      && outer.min.y <= inner.min.y && inner.max.y <= outer.max.y;
+}
+
+static inline AABB aabb_union(AABB a, AABB b) {
+  return (AABB){
+    { fmin(a.min.x, b.min.x), fmin(a.min.y, b.min.y) },
+    { fmax(a.max.x, b.max.x), fmax(a.max.y, b.max.y) },
+  };
+}
+
+// 2D stand-in for surface area
+static inline double aabb_perimeter(AABB a) {
+  return 2.0 * ((a.max.x - a.min.x) + (a.max.y - a.min.y));
+}
+
+DynamicTree *bvh_init(Bodies *);
+void bvh_add(DynamicTree *, uint32_t);
+size_t bvh_update(DynamicTree *);
+void bvh_compact(DynamicTree *, const uint32_t *, size_t);
+void bvh_clear(DynamicTree *);
+void bvh_free(DynamicTree *);
+
+void bvh_for_each_pair(DynamicTree *, pair_fn, void *);
+void bvh_apply_collisions(DynamicTree *);
+
+#endif // BVH_H_
@@ -0,0 +1,62 @@
+#include "channel.h"
+#include "log.h"
+
+void tbuf_init(TripleBuffer *tb, void *a, void *b, void *c) {
+  tb->slot[0] = a; tb->slot[1] = b; tb->slot[2] = c;
+  tb->back = 0;
+  atomic_init(&tb->middle, 1);
+  tb->front = 2;
+}
+
+void *tbuf_back(TripleBuffer *tb) { return tb->slot[tb->back]; }
+
+// back becomes middle, the old middle is the next one to fill
+void tbuf_publish(TripleBuffer *tb) {
+  unsigned old = atomic_exchange_explicit(&tb->middle, tb->back | TBUF_FRESH,
+                                          memory_order_acq_rel);
+  tb->back = old & ~TBUF_FRESH;
+}
+
+// the newest published slot, or the last one again if nothing new came
+void *tbuf_front(TripleBuffer *tb) {
+  if (atomic_load_explicit(&tb->middle, memory_order_relaxed) & TBUF_FRESH) {
+    unsigned old = atomic_exchange_explicit(&tb->middle, tb->front,
+                                            memory_order_acq_rel);
+    tb->front = old & ~TBUF_FRESH;
+  }
+  return tb->slot[tb->front];
+}
+
+CommandQueue *cmdq_init(void) {
+  CommandQueue *q = (CommandQueue *) aligned_alloc(_Alignof(CommandQueue),
+                                                   sizeof(CommandQueue));
+  if (q == NULL) PANIC_WITH(CMDQ_ALLOC_FAIL);
+  atomic_init(&q->head, 0);
+  atomic_init(&q->tail, 0);
+  return q;
+}
+
+// false when full, the command is dropped
+bool cmdq_push(CommandQueue *q, Command cmd) {
+  size_t t = atomic_load_explicit(&q->tail, memory_order_relaxed);
+  size_t h = atomic_load_explicit(&q->head, memory_order_acquire);
+  if (t - h == CMDQ_CAP) return false;
+  q->ring[t & (CMDQ_CAP - 1)] = cmd;
+  atomic_store_explicit(&q->tail, t + 1, memory_order_release);
+  return true;
+}
+
+// takes up to max commands in one go, the slots are handed back to the
+// producer with a single store
+size_t cmdq_pop_batch(CommandQueue *q, Command *out, size_t max) {
+  size_t h = atomic_load_explicit(&q->head, memory_order_relaxed);
+  size_t t = atomic_load_explicit(&q->tail, memory_order_acquire);
+  size_t n = t - h < max ? t - h : max;
+  for (size_t i = 0; i < n; i++) out[i] = q->ring[(h + i) & (CMDQ_CAP - 1)];
+  atomic_store_explicit(&q->head, h + n, memory_order_release);
+  return n;
+}
+
+void cmdq_free(CommandQueue *q) {
+  free(q);
+}
@@ -0,0 +1,53 @@
+#ifndef CHANNEL_H_
+#define CHANNEL_H_
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "nerd.h"
+
+#define TBUF_SLOTS 3
+#define TBUF_FRESH 4u   // set on the middle index when the writer published
+#define CMDQ_CAP   16384 // power of two, a second of brush strokes
+
+// one writer, one reader, never blocking either. the writer fills back,
+// the reader draws front, and middle is handed over by an atomic swap. a
+// reader that is slower than the writer simply skips the stale frames
+typedef struct {
+  _Atomic unsigned middle;
+  unsigned back;   // writer owned
+  unsigned front;  // reader owned
+  void *slot[TBUF_SLOTS];
+} TripleBuffer;
+
+void tbuf_init(TripleBuffer *, void *, void *, void *);
+void *tbuf_back(TripleBuffer *);
+void tbuf_publish(TripleBuffer *);
+void *tbuf_front(TripleBuffer *);
+
+typedef enum {
+  CMD_KEY,    // key press, key holds the glfw key
+  CMD_SPAWN,  // left click, q holds the position in world space
+} cmd_t;
+
+typedef struct {
+  cmd_t type;
+  int key;
+  vec2 q;
+} Command;
+
+// single producer, single consumer: the render thread's input callbacks
+// push, the sim thread drains. head and tail live on their own cache
+// lines so the two sides never write to a shared line
+typedef struct {
+  _Alignas(64) _Atomic size_t head;  // next to pop, consumer owned
+  _Alignas(64) _Atomic size_t tail;  // next to push, producer owned
+  Command ring[CMDQ_CAP];
+} CommandQueue;
+
+CommandQueue *cmdq_init(void);
+bool cmdq_push(CommandQueue *, Command);
+size_t cmdq_pop_batch(CommandQueue *, Command *, size_t);
+void cmdq_free(CommandQueue *);
+
+#endif // CHANNEL_H_
@@ -7,4 +7,12 @@
 #define WIN_W 1820
 #define WIN_H 900
 
+// latency isolation, only built in with make isolate. job worker w and
+// island worker w share core ISOLATE_WORKER_CORE + w - 1, the sim thread
+// drives both and never runs them at the same time
+#define ISOLATE_RENDER_CORE 0
+#define ISOLATE_SIM_CORE    1
+#define ISOLATE_WORKER_CORE 2
+#define ISOLATE_FIFO_PRIO   50
+
 #endif // CONFIG_H_
@@ -0,0 +1,157 @@
+#include "contact.h"
+#include "log.h"
+
+static int contact_cmp(const void *p1, const void *p2) {
+  const Contact *c1 = (const Contact *) p1, *c2 = (const Contact *) p2;
+  if (c1->a != c2->a) return c1->a < c2->a ? -1 : 1;
+  if (c1->b != c2->b) return c1->b < c2->b ? -1 : 1;
+  return 0;
+}
+
+ContactBuffer *contacts_init(Bodies *bodies) {
+  ContactBuffer *cb = (ContactBuffer *) calloc(1, sizeof(ContactBuffer));
+  if (cb == NULL) PANIC_WITH(CONTACT_ALLOC_FAIL);
+  cb->bodies = bodies;
+  return cb;
+}
+
+// last step's contacts become the warm start cache
+void contacts_begin(ContactBuffer *cb) {
+  Contact *data = cb->prev;
+  size_t cap = cb->prev_cap;
+  cb->prev = cb->data; cb->prev_len = cb->len; cb->prev_cap = cb->cap;
+  cb->data = data;     cb->len = 0;            cb->cap = cap;
+}
+
+void contact_emit(Bodies *b, uint32_t pi, uint32_t pj, void *ctx) {
+  ContactBuffer *cb = (ContactBuffer *) ctx;
+  vec2 diff = vec2sub(body_q(b, pj), body_q(b, pi));
+  double dist = vec2mag(diff);
+  double overlap = (b->R[pi] + b->R[pj]) - dist;
+  if (overlap <= 0.0f || dist <= 0.0f) return;
+  physics_touch(b, pi);
+  physics_touch(b, pj);
+  if (physics_is_asleep(b, pi) && physics_is_asleep(b, pj)) return;
+  physics_wake(b, pi);
+  physics_wake(b, pj);
+
+  if (cb->len == cb->cap) {
+    cb->cap = cb->cap ? 2 * cb->cap : 1024;
+    cb->data = realloc(cb->data, cb->cap * sizeof(Contact));
+    if (cb->data == NULL) PANIC_WITH(CONTACT_ALLOC_FAIL);
+  }
+  vec2 n = vec2scale(1.0f / dist, diff);
+  if (pj < pi) { uint32_t t = pi; pi = pj; pj = t; n = vec2scale(-1, n); }
+  cb->data[cb->len++] = (Contact){
+    .a = pi, .b = pj, .n = n, .overlap = overlap,
+    .m_eff = 1.0f / (1.0f / b->m[pi] + 1.0f / b->m[pj]),
+  };
+}
+
+static void apply_impulse(Bodies *b, Contact *c, double j) {
+  vec2 impulse = vec2scale(j, c->n);
+  body_set_v(b, c->a, vec2sub(body_v(b, c->a),
+                              vec2scale(1.0f / b->m[c->a], impulse)));
+  body_set_v(b, c->b, vec2add(body_v(b, c->b),
+                              vec2scale(1.0f / b->m[c->b], impulse)));
+}
+
+static inline double normal_speed(Bodies *b, Contact *c) {
+  return vec2dot(vec2sub(body_v(b, c->b), body_v(b, c->a)), c->n);
+}
+
+// both lists are sorted by key, so matching is a single merge walk
+static void contacts_warm_start(ContactBuffer *cb) {
+  size_t p = 0;
+  for (size_t k = 0; k < cb->len; k++) {
+    Contact *c = &cb->data[k];
+    while (p < cb->prev_len && contact_cmp(&cb->prev[p], c) < 0) p++;
+    if (p < cb->prev_len && contact_cmp(&cb->prev[p], c) == 0) {
+      c->jn = CONTACT_WARM_FACTOR * cb->prev[p].jn;
+      apply_impulse(cb->bodies, c, c->jn);
+    }
+  }
+}
+
+void contacts_prepare(ContactBuffer *cb, double e) {
+  if (cb->len > 1) qsort(cb->data, cb->len, sizeof(Contact), contact_cmp);
+  for (size_t k = 0; k < cb->len; k++) {
+    double vn = normal_speed(cb->bodies, &cb->data[k]);
+    cb->data[k].v_target = vn < -CONTACT_BOUNCE_MIN ? -e * vn : 0.0f;
+  }
+  contacts_warm_start(cb);
+}
+
+static inline Contact *contact_at(ContactBuffer *cb, const uint32_t *idx,
+                                  size_t k)
+{
+  return idx ? &cb->data[idx[k]] : &cb->data[k];
+}
+
+// idx selects a subset of the buffer, NULL means every contact
+void contacts_iterate(ContactBuffer *cb, const uint32_t *idx, size_t n,
+                      size_t iterations)
+{
+  for (size_t it = 0; it < iterations; it++) {
+    for (size_t k = 0; k < n; k++) {
+      Contact *c = contact_at(cb, idx, k);
+      double dj = c->m_eff * (c->v_target - normal_speed(cb->bodies, c));
+      double jn = c->jn + dj > 0.0f ? c->jn + dj : 0.0f;
+      apply_impulse(cb->bodies, c, jn - c->jn);
+      c->jn = jn;
+    }
+  }
+}
+
+void contacts_correct(ContactBuffer *cb, const uint32_t *idx, size_t n) {
+  Bodies *b = cb->bodies;
+  for (size_t k = 0; k < n; k++) {
+    Contact *c = contact_at(cb, idx, k);
+    double depth = c->overlap - CONTACT_SLOP;
+    if (depth <= 0.0f) continue;
+    vec2 corr = vec2scale(CONTACT_BETA * depth * c->m_eff, c->n);
+    body_set_q(b, c->a, vec2sub(body_q(b, c->a),
+                                vec2scale(1.0f / b->m[c->a], corr)));
+    body_set_q(b, c->b, vec2add(body_q(b, c->b),
+                                vec2scale(1.0f / b->m[c->b], corr)));
+  }
+}
+
+void contacts_solve(ContactBuffer *cb, size_t iterations, double e) {
+  contacts_prepare(cb, e);
+  contacts_iterate(cb, NULL, cb->len, iterations);
+  contacts_correct(cb, NULL, cb->len);
+}
+
+// follows entities_compact, so warm starting survives a despawn. the
+// contacts of removed bodies go, those of moved ones are rekeyed
+void contacts_compact(ContactBuffer *cb, const uint32_t *to) {
+  size_t n = 0;
+  bool moved = false;
+  for (size_t k = 0; k < cb->len; k++) {
+    Contact c = cb->data[k];
+    uint32_t a = c.a, b = c.b;
+    if (to[a] == BODY_REMOVED || to[b] == BODY_REMOVED) continue;
+    if (to[a] != a || to[b] != b) {
+      c.a = to[a];
+      c.b = to[b];
+      if (c.b < c.a) {
+        uint32_t t = c.a; c.a = c.b; c.b = t;
+        c.n = vec2scale(-1, c.n);
+      }
+      moved = true;
+    }
+    cb->data[n++] = c;
+  }
+  cb->len = n;
+  if (moved) qsort(cb->data, n, sizeof(Contact), contact_cmp);
+}
+
+void contacts_clear(ContactBuffer *cb) { cb->len = 0; cb->prev_len = 0; }
+
+void contacts_free(ContactBuffer *cb) {
+  if (cb == NULL) return;
+  free(cb->data);
+  free(cb->prev);
+  free(cb);
+}
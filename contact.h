@@ -0,0 +1,42 @@
+#ifndef CONTACT_H_
+#define CONTACT_H_
+#include <stddef.h>
+#include <stdint.h>
+
+#include "physics.h"
+
+#define CONTACT_ITERATIONS 4
+#define CONTACT_WARM_FACTOR 1.0  // fraction of last step's impulse reapplied
+#define CONTACT_SLOP 0.05        // overlap tolerated before correcting
+#define CONTACT_BETA 0.2         // fraction of overlap removed per step
+#define CONTACT_BOUNCE_MIN 10.0  // slower approaches are treated as resting
+
+typedef struct {
+  uint32_t a, b;         // body indices, a < b, doubles as the pair key
+  vec2 n;                // unit normal from a to b
+  double overlap;
+  double m_eff;          // 1 / (1/m_a + 1/m_b)
+  double v_target;       // separation speed demanded by restitution
+  double jn;             // accumulated normal impulse, never negative
+} Contact;
+
+typedef struct {
+  Bodies *bodies;
+  size_t len, cap;
+  Contact *data;
+  size_t prev_len, prev_cap;
+  Contact *prev;         // last step's contacts, sorted by key
+} ContactBuffer;
+
+ContactBuffer *contacts_init(Bodies *);
+void contacts_begin(ContactBuffer *);
+void contact_emit(Bodies *, uint32_t, uint32_t, void *);
+void contacts_solve(ContactBuffer *, size_t, double);
+void contacts_prepare(ContactBuffer *, double);
+void contacts_iterate(ContactBuffer *, const uint32_t *, size_t, size_t);
+void contacts_correct(ContactBuffer *, const uint32_t *, size_t);
+void contacts_compact(ContactBuffer *, const uint32_t *);
+void contacts_clear(ContactBuffer *);
+void contacts_free(ContactBuffer *);
+
+#endif // CONTACT_H_
@@ -0,0 +1,393 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "domain.h"
+#include "config.h"
+#include "log.h"
+
+#define MSG_BYTES sizeof(DomainMsg)
+
+static size_t dom_owner(Domain *d, double x) {
+  for (size_t r = 0; r + 1 < d->procs; r++) {
+    if (x < d->edge[r + 1]) return r;
+  }
+  return d->procs - 1;
+}
+
+// bodies travel as whole records, gathered from the store
+static void peer_queue(DomainPeer *p, EntityArray *ea, size_t i) {
+  if (p->out_len == p->out_cap) {
+    p->out_cap = p->out_cap ? 2 * p->out_cap : 64;
+    p->out = (PhysicsEntity *)
+      realloc(p->out, p->out_cap * sizeof(PhysicsEntity));
+    if (p->out == NULL) PANIC_WITH(DOMAIN_ALLOC_FAIL);
+  }
+  p->out[p->out_len++] = entities_load(ea, i);
+}
+
+static size_t peer_out_bytes(DomainPeer *p) {
+  return MSG_BYTES + p->out_len * sizeof(PhysicsEntity);
+}
+
+static bool peer_in_done(DomainPeer *p) {
+  return p->got >= MSG_BYTES
+    && p->got == MSG_BYTES + p->in_hdr.count * sizeof(PhysicsEntity);
+}
+
+static bool would_block(void) {
+  return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+}
+
+static void peer_send(DomainPeer *p) {
+  const char *src;
+  size_t left;
+  if (p->sent < MSG_BYTES) {
+    src = (const char *) &p->out_hdr + p->sent;
+    left = MSG_BYTES - p->sent;
+  } else {
+    src = (const char *) p->out + (p->sent - MSG_BYTES);
+    left = peer_out_bytes(p) - p->sent;
+  }
+  ssize_t n = send(p->fd, src, left, MSG_NOSIGNAL);
+  if (n < 0) {
+    if (would_block()) return;
+    PANIC_WITH(DOMAIN_PEER_LOST);
+  }
+  p->sent += (size_t) n;
+}
+
+static void peer_recv(DomainPeer *p, dom_phase_t phase) {
+  char *dst;
+  size_t left;
+  if (p->got < MSG_BYTES) {
+    dst = (char *) &p->in_hdr + p->got;
+    left = MSG_BYTES - p->got;
+  } else {
+    dst = (char *) p->in + (p->got - MSG_BYTES);
+    left = MSG_BYTES + p->in_hdr.count * sizeof(PhysicsEntity) - p->got;
+  }
+  ssize_t n = recv(p->fd, dst, left, 0);
+  if (n == 0) PANIC_WITH(DOMAIN_PEER_LOST);
+  if (n < 0) {
+    if (would_block()) return;
+    PANIC_WITH(DOMAIN_PEER_LOST);
+  }
+  p->got += (size_t) n;
+  if (p->got != MSG_BYTES) return;
+  // header complete, make room for the bodies behind it
+  if (p->in_hdr.phase != phase) PANIC_WITH(DOMAIN_BAD_MESSAGE);
+  if (p->in_hdr.count > p->in_cap) {
+    p->in_cap = p->in_hdr.count;
+    p->in = (PhysicsEntity *)
+      realloc(p->in, p->in_cap * sizeof(PhysicsEntity));
+    if (p->in == NULL) PANIC_WITH(DOMAIN_ALLOC_FAIL);
+  }
+}
+
+// every domain sends its queued bodies and summary to every other one and
+// takes theirs. all sockets are driven at once so two peers writing large
+// messages at each other can never wedge on full socket buffers
+static void dom_exchange(Domain *d, dom_phase_t phase) {
+  struct pollfd pfd[DOM_MAX_PROCS];
+  size_t who[DOM_MAX_PROCS];
+  for (size_t r = 0; r < d->procs; r++) {
+    if (r == d->rank) continue;
+    DomainPeer *p = &d->peers[r];
+    p->out_hdr = (DomainMsg){
+      .phase = phase,
+      .from = (uint32_t) d->rank,
+      .count = p->out_len,
+      .summary = d->mine,
+    };
+    p->sent = 0;
+    p->got = 0;
+  }
+  for (;;) {
+    size_t n = 0;
+    for (size_t r = 0; r < d->procs; r++) {
+      if (r == d->rank) continue;
+      DomainPeer *p = &d->peers[r];
+      short ev = 0;
+      if (p->sent < peer_out_bytes(p)) ev |= POLLOUT;
+      if (!peer_in_done(p)) ev |= POLLIN;
+      if (ev == 0) continue;
+      pfd[n] = (struct pollfd){ .fd = p->fd, .events = ev };
+      who[n++] = r;
+    }
+    if (n == 0) break;
+    if (poll(pfd, n, -1) < 0) {
+      if (errno == EINTR) continue;
+      PANIC_WITH(DOMAIN_PEER_LOST);
+    }
+    for (size_t k = 0; k < n; k++) {
+      DomainPeer *p = &d->peers[who[k]];
+      if (pfd[k].revents & POLLOUT) peer_send(p);
+      if (pfd[k].revents & (POLLIN | POLLHUP | POLLERR)) peer_recv(p, phase);
+    }
+  }
+  for (size_t r = 0; r < d->procs; r++) {
+    d->all[r] = r == d->rank ? d->mine : d->peers[r].in_hdr.summary;
+    d->peers[r].out_len = 0;
+  }
+}
+
+// forks procs - 1 children over a full mesh of unix socket pairs, the
+// caller comes back as rank 0 and every child as its own rank
+Domain *dom_launch(size_t procs) {
+  if (procs == 0 || procs > DOM_MAX_PROCS
+      || (double) procs * DOM_MIN_SLAB > WIN_W) {
+    PANIC_WITH(DOMAIN_BAD_PROCS);
+  }
+  int fds[DOM_MAX_PROCS][DOM_MAX_PROCS];  // fds[a][b] is a's end to b
+  for (size_t a = 0; a < procs; a++) {
+    for (size_t b = a + 1; b < procs; b++) {
+      int pair[2];
+      if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) < 0) {
+        PANIC_WITH(DOMAIN_SOCKET_FAIL);
+      }
+      fds[a][b] = pair[0];
+      fds[b][a] = pair[1];
+    }
+  }
+
+  Domain *d = (Domain *) calloc(1, sizeof(Domain));
+  if (d == NULL) PANIC_WITH(DOMAIN_ALLOC_FAIL);
+  d->procs = procs;
+  fflush(stdout);  // or the children print it again
+  for (size_t r = 1; r < procs; r++) {
+    pid_t pid = fork();
+    if (pid < 0) PANIC_WITH(DOMAIN_FORK_FAIL);
+    if (pid == 0) {
+      d->rank = r;
+      memset(d->children, 0, sizeof(d->children));
+      break;
+    }
+    d->children[r] = pid;
+  }
+
+  for (size_t a = 0; a < procs; a++) {
+    for (size_t b = 0; b < procs; b++) {
+      if (a == b) continue;
+      if (a != d->rank) {
+        close(fds[a][b]);
+        continue;
+      }
+      d->peers[b].fd = fds[a][b];
+      int flags = fcntl(fds[a][b], F_GETFL);
+      if (flags < 0 || fcntl(fds[a][b], F_SETFL, flags | O_NONBLOCK) < 0) {
+        PANIC_WITH(DOMAIN_SOCKET_FAIL);
+      }
+    }
+  }
+  d->peers[d->rank].fd = -1;
+
+  for (size_t r = 0; r <= procs; r++) {
+    d->edge[r] = (double) WIN_W * (double) r / (double) procs;
+  }
+  return d;
+}
+
+// every rank is handed the same full body list and keeps its own slab.
+// the sim is single threaded, the processes are the parallelism
+void dom_populate(Domain *d, PhysicsEntity *ents, size_t n) {
+  d->sim = sim_init((SimConfig){
+    .max_bodies = ENTITY_RESERVE_BODIES,
+    .initial_bodies = n / d->procs + 1,
+    .arena_bytes = 1 << 20,
+    .arena_strat = PAGE_VIRTUALLY,
+    .job_workers = 0,
+    .island_workers = 1,
+  });
+  d->initial = n;
+  d->initial_m = 0.0;
+  d->sink_m0 = atomic_load(&d->sim->sink.M);
+  for (size_t i = 0; i < n; i++) {
+    d->initial_m += ents[i].m;
+    if (dom_owner(d, ents[i].q.x) == d->rank) sim_spawn(d->sim, ents[i]);
+  }
+  sim_reindex(d->sim);
+}
+
+static void dom_summarize(Domain *d) {
+  Bodies *b = d->sim->bodies;
+  DomainSummary *s = &d->mine;
+  s->bodies = b->len;
+  s->m = 0.0;
+  memset(s->hist, 0, sizeof(s->hist));
+  for (size_t i = 0; i < b->len; i++) {
+    s->m += b->m[i];
+    double t = b->x[i] / (double) WIN_W * DOM_HIST_BINS;
+    size_t bin = t <= 0.0 ? 0 : (size_t) t;
+    s->hist[bin < DOM_HIST_BINS ? bin : DOM_HIST_BINS - 1]++;
+  }
+}
+
+// bodies outside the slab go to their owner, theirs come back
+static void dom_migrate(Domain *d) {
+  Simulation *s = d->sim;
+  Bodies *b = s->bodies;
+  EntityArray *ea = s->entities;
+  for (size_t i = 0; i < b->len; i++) {
+    size_t owner = dom_owner(d, b->x[i]);
+    if (owner == d->rank) continue;
+    peer_queue(&d->peers[owner], ea, i);
+    entities_despawn(ea, entities_handle_of(ea, i));
+    d->mine.migrated++;
+  }
+  sim_compact(s);
+  dom_exchange(d, DOM_MIGRATE);
+  size_t first = b->len;
+  for (size_t r = 0; r < d->procs; r++) {
+    if (r == d->rank) continue;
+    DomainPeer *p = &d->peers[r];
+    for (size_t k = 0; k < p->in_hdr.count; k++) sim_spawn(s, p->in[k]);
+  }
+  sim_index_from(s, first);
+}
+
+// slab edges at the quantiles of the summed histogram. every rank sees
+// the same histograms, so every rank computes the same edges
+static void dom_rebalance(Domain *d) {
+  uint64_t hist[DOM_HIST_BINS] = {0};
+  uint64_t total = 0;
+  for (size_t r = 0; r < d->procs; r++) {
+    for (size_t k = 0; k < DOM_HIST_BINS; k++) {
+      hist[k] += d->all[r].hist[k];
+      total += d->all[r].hist[k];
+    }
+  }
+  if (total == 0) return;
+  size_t next = 1;
+  uint64_t acc = 0;
+  for (size_t k = 0; k < DOM_HIST_BINS && next < d->procs; k++) {
+    acc += hist[k];
+    while (next < d->procs && acc * d->procs >= total * next) {
+      d->edge[next++] = (double) WIN_W * (double) (k + 1) / DOM_HIST_BINS;
+    }
+  }
+  while (next < d->procs) d->edge[next++] = WIN_W;
+
+  // no slab thinner than the ghost band on both of its sides
+  for (size_t r = 1; r < d->procs; r++) {
+    double lo = d->edge[r - 1] + DOM_MIN_SLAB;
+    if (d->edge[r] < lo) d->edge[r] = lo;
+  }
+  for (size_t r = d->procs - 1; r >= 1; r--) {
+    double hi = d->edge[r + 1] - DOM_MIN_SLAB;
+    if (d->edge[r] > hi) d->edge[r] = hi;
+  }
+}
+
+// one step of the whole world, every rank must call it the same number
+// of times. ghosts are stepped alongside the owned bodies so collisions
+// across an edge are seen by both sides, then dropped again
+void dom_step(Domain *d, double dt) {
+  Simulation *s = d->sim;
+  Bodies *b = s->bodies;
+  EntityArray *ea = s->entities;
+  size_t owned = b->len;
+
+  for (size_t i = 0; i < owned; i++) {
+    if (d->rank > 0 && b->x[i] < d->edge[d->rank] + DOM_GHOST) {
+      peer_queue(&d->peers[d->rank - 1], ea, i);
+      d->mine.ghosts++;
+    }
+    if (d->rank + 1 < d->procs && b->x[i] >= d->edge[d->rank + 1] - DOM_GHOST)
+    {
+      peer_queue(&d->peers[d->rank + 1], ea, i);
+      d->mine.ghosts++;
+    }
+  }
+  dom_exchange(d, DOM_GHOSTS);
+  for (size_t r = 0; r < d->procs; r++) {
+    if (r == d->rank) continue;
+    DomainPeer *p = &d->peers[r];
+    for (size_t k = 0; k < p->in_hdr.count; k++) sim_spawn(s, p->in[k]);
+  }
+  sim_index_from(s, owned);
+
+  double M0 = atomic_load(&s->sink.M);
+  sim_rebuild_tree(s);
+  sim_step(s, dt);
+
+  // what a ghost fed the sink is its owner's to report, not ours
+  double ghost_dm = 0.0;
+  for (size_t i = b->len; i-- > owned;) {
+    if (physics_captured_by_sink(b, i, s->sink.q)) ghost_dm += b->m[i];
+    entities_despawn(ea, entities_handle_of(ea, i));
+  }
+  sim_compact(s);
+
+  size_t before = b->len;
+  sim_settle(s);
+  d->mine.captured += before - b->len;
+  d->mine.sink_dm = atomic_load(&s->sink.M) - M0 - ghost_dm;
+
+  dom_summarize(d);
+  dom_migrate(d);
+
+  double M = M0;
+  for (size_t r = 0; r < d->procs; r++) M += d->all[r].sink_dm;
+  atomic_store(&s->sink.M, M);
+
+  if (++d->steps % DOM_REBALANCE == 0) {
+    dom_rebalance(d);
+    d->mine.sink_dm = 0.0;
+    dom_migrate(d);
+  }
+}
+
+// collective, rank 0 prints the table
+void dom_report(Domain *d) {
+  dom_summarize(d);
+  d->mine.sink_dm = 0.0;
+  dom_exchange(d, DOM_REPORT);
+  if (d->rank != 0) return;
+
+  uint64_t bodies = 0, captured = 0;
+  double m = 0.0;
+  printf("rank      slab       bodies   captured   migrated     ghosts\n");
+  for (size_t r = 0; r < d->procs; r++) {
+    DomainSummary *s = &d->all[r];
+    printf("%4zu %5.0f-%-5.0f %9lu %10lu %10lu %10lu\n", r,
+           d->edge[r], d->edge[r + 1], (unsigned long) s->bodies,
+           (unsigned long) s->captured, (unsigned long) s->migrated,
+           (unsigned long) s->ghosts);
+    bodies += s->bodies;
+    captured += s->captured;
+    m += s->m;
+  }
+  double sink = atomic_load(&d->sim->sink.M) - d->sink_m0;
+  printf("%zu steps, %lu bodies + %lu captured of %zu, mass drift %g\n",
+         d->steps, (unsigned long) bodies, (unsigned long) captured,
+         d->initial, m + sink - d->initial_m);
+  if (bodies + captured != d->initial) PANIC_WITH(DOMAIN_BODIES_LOST);
+}
+
+// children exit here, rank 0 returns once all of them have
+void dom_finish(Domain *d) {
+  for (size_t r = 0; r < d->procs; r++) {
+    if (r != d->rank) close(d->peers[r].fd);
+    free(d->peers[r].out);
+    free(d->peers[r].in);
+  }
+  sim_free(d->sim);
+  if (d->rank != 0) {
+    free(d);
+    exit(EXIT_SUCCESS);
+  }
+  for (size_t r = 1; r < d->procs; r++) {
+    int status;
+    if (waitpid(d->children[r], &status, 0) < 0
+        || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      PANIC_WITH(DOMAIN_CHILD_FAIL);
+    }
+  }
+  free(d);
+}
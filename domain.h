@@ -0,0 +1,77 @@
+#ifndef DOMAIN_H_
+#define DOMAIN_H_
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "sim.h"
+
+#define DOM_MAX_PROCS  16
+#define DOM_GHOST      32.0  // border band copied to the neighbour each step
+#define DOM_MIN_SLAB   (4 * DOM_GHOST)
+#define DOM_HIST_BINS  256   // x histogram the slabs are rebalanced from
+#define DOM_REBALANCE  60    // steps between rebalances
+
+typedef enum {
+  DOM_GHOSTS,
+  DOM_MIGRATE,
+  DOM_REPORT,
+} dom_phase_t;
+
+// what a domain tells every other one once per step. the sink is global,
+// each domain adds what its own bodies fed it and all of them apply the
+// same sum in rank order, so every copy of the sink stays bit identical
+typedef struct {
+  uint64_t bodies;
+  double m;             // owned mass
+  double sink_dm;       // mass the sink took from owned bodies this step
+  uint64_t captured;    // since the start
+  uint64_t migrated;    // sent to other domains since the start
+  uint64_t ghosts;      // sent to neighbours since the start
+  uint32_t hist[DOM_HIST_BINS];
+} DomainSummary;
+
+typedef struct {
+  uint32_t phase;
+  uint32_t from;
+  uint64_t count;       // bodies after the header
+  DomainSummary summary;
+} DomainMsg;
+
+// one unix socket per peer, every exchange sends one message to and
+// takes one message from each of them, bodies ride behind the header
+typedef struct {
+  int fd;
+  DomainMsg out_hdr;
+  PhysicsEntity *out;
+  size_t out_len, out_cap;
+  size_t sent;          // bytes of header plus bodies
+  DomainMsg in_hdr;
+  PhysicsEntity *in;
+  size_t in_cap;
+  size_t got;
+} DomainPeer;
+
+// the world is cut into vertical slabs, one per process, moved every
+// DOM_REBALANCE steps so each holds about the same number of bodies
+typedef struct {
+  size_t rank, procs;
+  pid_t children[DOM_MAX_PROCS];
+  DomainPeer peers[DOM_MAX_PROCS];
+  double edge[DOM_MAX_PROCS + 1];   // slab r is [edge[r], edge[r + 1])
+  Simulation *sim;
+  size_t steps;
+  size_t initial;       // bodies over all ranks at populate
+  double initial_m;
+  double sink_m0;
+  DomainSummary mine;
+  DomainSummary all[DOM_MAX_PROCS];
+} Domain;
+
+Domain *dom_launch(size_t);
+void dom_populate(Domain *, PhysicsEntity *, size_t);
+void dom_step(Domain *, double);
+void dom_report(Domain *);
+void dom_finish(Domain *);
+
+#endif // DOMAIN_H_
@@ -0,0 +1,55 @@
+#include "ensemble.h"
+#include "log.h"
+
+Ensemble *ensemble_init(size_t workers) {
+  Ensemble *e = (Ensemble *) calloc(1, sizeof(Ensemble));
+  if (e == NULL) PANIC_WITH(ENSEMBLE_ALLOC_FAIL);
+  e->pool = jobs_init(workers);
+  return e;
+}
+
+// the member belongs to the ensemble, fill it with bodies before a run
+Simulation *ensemble_add(Ensemble *e, SimConfig cfg) {
+  if (e->len == e->cap) {
+    e->cap = e->cap ? 2 * e->cap : 64;
+    e->sims = realloc(e->sims, e->cap * sizeof(Simulation *));
+    if (e->sims == NULL) PANIC_WITH(ENSEMBLE_ALLOC_FAIL);
+  }
+  cfg.job_workers = 0;
+  cfg.island_workers = 1;
+  Simulation *s = sim_init(cfg);
+  e->sims[e->len++] = s;
+  return s;
+}
+
+static void ensemble_job(void *arg, size_t begin, size_t end, size_t worker)
+{
+  (void) worker;
+  Ensemble *e = (Ensemble *) arg;
+  for (size_t k = begin; k < end; k++) {
+    sim_advance(e->sims[k], e->steps, e->dt);
+  }
+}
+
+// one job per member so a slow scenario never holds up a whole chunk,
+// the pool takes at most JOB_POOL_CAP of them per round
+void ensemble_run(Ensemble *e, size_t steps, double dt) {
+  e->steps = steps;
+  e->dt = dt;
+  for (size_t first = 0; first < e->len; first += JOB_POOL_CAP) {
+    size_t last = first + JOB_POOL_CAP < e->len ? first + JOB_POOL_CAP
+                                                : e->len;
+    for (size_t k = first; k < last; k++) {
+      jobs_create(e->pool, ensemble_job, e, k, k + 1);
+    }
+    jobs_run(e->pool);
+  }
+}
+
+void ensemble_free(Ensemble *e) {
+  if (e == NULL) return;
+  for (size_t k = 0; k < e->len; k++) sim_free(e->sims[k]);
+  free(e->sims);
+  jobs_free(e->pool);
+  free(e);
+}
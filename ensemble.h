@@ -0,0 +1,25 @@
+#ifndef ENSEMBLE_H_
+#define ENSEMBLE_H_
+#include <stddef.h>
+
+#include "sim.h"
+#include "jobs.h"
+
+// many small independent simulations, each stepped whole by one worker.
+// members never own threads of their own, the pool is the only
+// parallelism, so a sweep of hundreds of scenarios keeps every core busy
+// without oversubscribing it
+typedef struct {
+  JobSystem *pool;
+  Simulation **sims;
+  size_t len, cap;
+  size_t steps;  // of the run in progress
+  double dt;
+} Ensemble;
+
+Ensemble *ensemble_init(size_t);
+Simulation *ensemble_add(Ensemble *, SimConfig);
+void ensemble_run(Ensemble *, size_t, double);
+void ensemble_free(Ensemble *);
+
+#endif // ENSEMBLE_H_
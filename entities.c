@@ -0,0 +1,240 @@
+#include "entities.h"
+#include "log.h"
+
+// every array of the store, hot fields first
+#define EACH_FIELD(DO)                                        \
+  DO(x) DO(y) DO(vx) DO(vy) DO(ax) DO(ay) DO(m)               \
+  DO(R) DO(color) DO(state) DO(idle) DO(contact)
+
+static size_t field_span(size_t bodies, size_t size) {
+  return (bodies * size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+}
+
+EntityArray *entities_init(size_t reserve) {
+  if (reserve >= ENTITY_DYING) PANIC_WITH(VMEM_RESERVE_FAIL);
+  EntityArray *ea = (EntityArray *) calloc(1, sizeof(EntityArray));
+  if (ea == NULL) PANIC_WITH(VMEM_RESERVE_FAIL);
+  Bodies *b = &ea->store;
+  ea->reserved = reserve;
+#define FIELD_SPAN(F) ea->span += field_span(reserve, sizeof(*b->F));
+  EACH_FIELD(FIELD_SPAN)
+#undef FIELD_SPAN
+  char *at = vmem_reserve_huge(ea->span);
+#define FIELD_CARVE(F)                                        \
+  b->F = (void *) at;                                         \
+  at += field_span(reserve, sizeof(*b->F));
+  EACH_FIELD(FIELD_CARVE)
+#undef FIELD_CARVE
+  return ea;
+}
+
+// bodies [from, to) of every array, false as soon as one mlock fails
+static bool entities_mlock(EntityArray *ea, size_t from, size_t to) {
+  Bodies *b = &ea->store;
+  bool ok = true;
+#define FIELD_LOCK(F)                                                 \
+  ok = ok && mlock(b->F + from, (to - from) * sizeof(*b->F)) == 0;
+  EACH_FIELD(FIELD_LOCK)
+#undef FIELD_LOCK
+  return ok;
+}
+
+static void entities_munlock(EntityArray *ea) {
+  Bodies *b = &ea->store;
+#define FIELD_UNLOCK(F) munlock(b->F, ea->committed * sizeof(*b->F));
+  EACH_FIELD(FIELD_UNLOCK)
+#undef FIELD_UNLOCK
+}
+
+// commit at least doubles, the number of mprotect calls is logarithmic.
+// a locked store that hits RLIMIT_MEMLOCK keeps going unlocked, the same
+// as a locked arena does
+static void entities_commit(EntityArray *ea, size_t n) {
+  if (n > ea->reserved) PANIC_WITH(ENTITY_RESERVE_EXHAUSTED);
+  Bodies *b = &ea->store;
+  size_t want = ea->committed;
+  if (want < ENTITY_COMMIT_MIN) want = ENTITY_COMMIT_MIN;
+  while (want < n) want *= 2;
+  if (want > ea->reserved) want = ea->reserved;
+#define FIELD_COMMIT(F) vmem_commit(b->F, want * sizeof(*b->F));
+  EACH_FIELD(FIELD_COMMIT)
+#undef FIELD_COMMIT
+  size_t from = ea->committed;
+  ea->committed = want;
+  if (ea->locked && !entities_mlock(ea, from, want)) {
+    entities_munlock(ea);
+    ea->locked = false;
+  }
+  ea->body_slot = realloc(ea->body_slot, ea->committed * sizeof(uint32_t));
+  if (ea->body_slot == NULL) PANIC_WITH(ENTITY_ALLOC_FAIL);
+}
+
+// commits room for n bodies up front, so the pages can be faulted in
+// before anything is spawned into them
+void entities_grow(EntityArray *ea, size_t n) {
+  if (n > ea->committed) entities_commit(ea, n);
+}
+
+// faults in the pages behind the free bodies of [begin, end) in every
+// array. only bytes past the live bodies are written
+void entities_touch(EntityArray *ea, size_t begin, size_t end) {
+  Bodies *b = &ea->store;
+  if (begin < b->len) begin = b->len;
+  if (end > ea->committed) end = ea->committed;
+  if (begin >= end) return;
+#define FIELD_TOUCH(F)                                                \
+  vmem_touch(b->F + begin, (end - begin) * sizeof(*b->F), false);
+  EACH_FIELD(FIELD_TOUCH)
+#undef FIELD_TOUCH
+}
+
+static uint32_t slot_acquire(EntityArray *ea) {
+  if (ea->free_len > 0) return ea->free_slots[--ea->free_len];
+  if (ea->slot_len == ea->slot_cap) {
+    ea->slot_cap = ea->slot_cap ? 2 * ea->slot_cap : 1024;
+    ea->slot_body  = realloc(ea->slot_body,  ea->slot_cap * sizeof(uint32_t));
+    ea->slot_gen   = realloc(ea->slot_gen,   ea->slot_cap * sizeof(uint32_t));
+    ea->free_slots = realloc(ea->free_slots, ea->slot_cap * sizeof(uint32_t));
+    ea->dead       = realloc(ea->dead,       ea->slot_cap * sizeof(uint32_t));
+    if (!ea->slot_body || !ea->slot_gen || !ea->free_slots || !ea->dead) {
+      PANIC_WITH(ENTITY_ALLOC_FAIL);
+    }
+  }
+  ea->slot_gen[ea->slot_len] = 1;
+  return (uint32_t) ea->slot_len++;
+}
+
+// scatters the record over the arrays
+static void store_body(Bodies *b, size_t i, PhysicsEntity e) {
+  b->x[i]  = e.q.x;       b->y[i]  = e.q.y;
+  b->vx[i] = e.dq_dt.x;   b->vy[i] = e.dq_dt.y;
+  b->ax[i] = e.d2q_dt2.x; b->ay[i] = e.d2q_dt2.y;
+  b->m[i]  = e.m;
+  b->R[i]  = e.geom_t == GEOM_CIRCLE ? e.geom.circ.R : 0.0;
+  b->color[i]   = e.color;
+  b->state[i]   = e.state;
+  b->idle[i]    = e.idle;
+  b->contact[i] = e.contact;
+}
+
+// gathers body i back into a record, for whatever leaves the store
+PhysicsEntity entities_load(EntityArray *ea, size_t i) {
+  Bodies *b = &ea->store;
+  PhysicsEntity e = new_physics_entity(
+    body_q(b, i), body_v(b, i), (vec2){ b->ax[i], b->ay[i] },
+    b->m[i], b->color[i]
+  );
+  physics_entity_bind_geometry(&e, GEOM_CIRCLE, (Geometry){
+      .circ.R = b->R[i]
+  });
+  e.state   = b->state[i];
+  e.idle    = b->idle[i];
+  e.contact = b->contact[i];
+  return e;
+}
+
+BodyHandle entities_spawn(EntityArray *ea, PhysicsEntity e) {
+  Bodies *b = &ea->store;
+  if (b->len == ea->committed) entities_commit(ea, b->len + 1);
+  uint32_t slot = slot_acquire(ea);
+  uint32_t i = (uint32_t) b->len++;
+  store_body(b, i, e);
+  ea->body_slot[i] = slot;
+  ea->slot_body[slot] = i;
+  return (BodyHandle){ slot, ea->slot_gen[slot] };
+}
+
+// free slots are ENTITY_NONE, which has the dying bit set as well
+static bool handle_live(EntityArray *ea, BodyHandle h) {
+  return h.slot < ea->slot_len && ea->slot_gen[h.slot] == h.gen
+      && (ea->slot_body[h.slot] & ENTITY_DYING) == 0;
+}
+
+// where the body sits in the store, ENTITY_NONE once it is despawned
+size_t entities_index(EntityArray *ea, BodyHandle h) {
+  return handle_live(ea, h) ? ea->slot_body[h.slot] : ENTITY_NONE;
+}
+
+// a body that is already despawned gives a handle that is not live
+BodyHandle entities_handle_of(EntityArray *ea, size_t i) {
+  uint32_t slot = ea->body_slot[i];
+  return (BodyHandle){ slot, ea->slot_gen[slot] };
+}
+
+// the handle dies at once, the body itself lingers until entities_compact
+// so indices held by the broadphases stay valid for the rest of the step.
+// the slot is flagged, so neither that handle nor one taken from the
+// body's index again can despawn it twice
+bool entities_despawn(EntityArray *ea, BodyHandle h) {
+  if (!handle_live(ea, h)) return false;
+  ea->slot_gen[h.slot]++;
+  ea->slot_body[h.slot] |= ENTITY_DYING;
+  ea->dead[ea->dead_len++] = h.slot;
+  return true;
+}
+
+// swap-removes every pending body, returns how many went. bodies only
+// ever move from the tail down into holes, everything below the new len
+// that survived stays put. to, when given, has room for len entries and
+// maps each old index to the new one, BODY_REMOVED for the bodies that went
+size_t entities_compact(EntityArray *ea, uint32_t *to) {
+  Bodies *b = &ea->store;
+  size_t removed = ea->dead_len;
+  size_t len = b->len;
+  for (size_t k = 0; to && k < len; k++) to[k] = ea->body_slot[k];
+  for (size_t d = 0; d < ea->dead_len; d++) {
+    uint32_t slot = ea->dead[d];
+    uint32_t i = ea->slot_body[slot] & ~ENTITY_DYING;
+    uint32_t last = (uint32_t) --b->len;
+    if (i != last) {
+      uint32_t moved = ea->body_slot[last];
+#define FIELD_MOVE(F) b->F[i] = b->F[last];
+      EACH_FIELD(FIELD_MOVE)
+#undef FIELD_MOVE
+      ea->body_slot[i] = moved;
+      ea->slot_body[moved] = i | (ea->slot_body[moved] & ENTITY_DYING);
+    }
+    ea->slot_body[slot] = ENTITY_NONE;
+    ea->free_slots[ea->free_len++] = slot;
+  }
+  ea->dead_len = 0;
+  for (size_t k = 0; to && k < len; k++) {
+    uint32_t i = ea->slot_body[to[k]];
+    to[k] = i == ENTITY_NONE ? BODY_REMOVED : i;
+  }
+  return removed;
+}
+
+// every outstanding handle goes stale, pages stay committed for reuse
+void entities_clear(EntityArray *ea) {
+  for (size_t i = 0; i < ea->store.len; i++) {
+    uint32_t slot = ea->body_slot[i];
+    ea->slot_gen[slot]++;
+    ea->slot_body[slot] = ENTITY_NONE;
+    ea->free_slots[ea->free_len++] = slot;
+  }
+  ea->store.len = 0;
+  ea->dead_len = 0;
+}
+
+// pins every committed array, and whatever is committed later on, so a
+// spawn never page faults. false when the lock is not permitted
+bool entities_lock(EntityArray *ea) {
+  if (!entities_mlock(ea, 0, ea->committed)) {
+    entities_munlock(ea);
+    return false;
+  }
+  ea->locked = true;
+  return true;
+}
+
+void entities_free(EntityArray *ea) {
+  if (ea == NULL) return;
+  vmem_release(ea->store.x, ea->span);
+  free(ea->body_slot);
+  free(ea->slot_body);
+  free(ea->slot_gen);
+  free(ea->free_slots);
+  free(ea->dead);
+  free(ea);
+}
@@ -0,0 +1,58 @@
+#ifndef ENTITIES_H_
+#define ENTITIES_H_
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "physics.h"
+#include "alloc.h"
+
+#define ENTITY_RESERVE_BODIES (1ull << 26)  // address space only, ~6 GB
+#define ENTITY_COMMIT_MIN     (1ull << 15)  // bodies committed per growth
+#define ENTITY_NONE           UINT32_MAX
+#define ENTITY_DYING          0x80000000u  // set on the slot until compaction
+
+// a handle names a slot; the slot maps to wherever the body currently
+// sits in the dense array. despawning bumps the slot's generation, so
+// stale handles resolve to NULL instead of to whoever reused the slot
+typedef struct {
+  uint32_t slot;
+  uint32_t gen;
+} BodyHandle;
+
+// one reservation carved into a huge page aligned span per array of the
+// store, so index i only changes when compaction swaps a body down into
+// a hole. store.len is the number of live bodies
+typedef struct {
+  Bodies store;
+  size_t committed;    // bodies backed by readable pages in every array
+  size_t reserved;     // bodies the reservation can ever hold
+  size_t span;         // bytes of the whole reservation
+  bool locked;         // committed arrays are mlocked, see entities_lock
+
+  uint32_t *body_slot; // dense index -> slot
+  uint32_t *slot_body; // slot -> dense index, ENTITY_NONE when free and
+                       // with ENTITY_DYING set while despawned
+  uint32_t *slot_gen;
+  size_t slot_len;
+  size_t slot_cap;
+  uint32_t *free_slots;
+  size_t free_len;
+  uint32_t *dead;      // slots despawned since the last compaction
+  size_t dead_len;
+} EntityArray;
+
+EntityArray *entities_init(size_t reserve);
+void entities_grow(EntityArray *, size_t);
+void entities_touch(EntityArray *, size_t, size_t);
+BodyHandle entities_spawn(EntityArray *, PhysicsEntity);
+bool entities_despawn(EntityArray *, BodyHandle);
+size_t entities_index(EntityArray *, BodyHandle);
+PhysicsEntity entities_load(EntityArray *, size_t);
+BodyHandle entities_handle_of(EntityArray *, size_t);
+size_t entities_compact(EntityArray *, uint32_t *);
+void entities_clear(EntityArray *);
+bool entities_lock(EntityArray *);
+void entities_free(EntityArray *);
+
+#endif // ENTITIES_H_
@@ -0,0 +1,355 @@
+#include <math.h>
+#include <string.h>
+
+#include "events.h"
+#include "config.h"
+#include "log.h"
+
+static void heap_swap(Event *h, size_t i, size_t j) {
+  Event tmp = h[i];
+  h[i] = h[j];
+  h[j] = tmp;
+}
+
+static void heap_up(Event *h, size_t i) {
+  while (i > 0) {
+    size_t p = (i - 1) / 2;
+    if (h[p].t <= h[i].t) return;
+    heap_swap(h, i, p);
+    i = p;
+  }
+}
+
+static void heap_down(Event *h, size_t len, size_t i) {
+  for (;;) {
+    size_t l = 2 * i + 1, r = l + 1, m = i;
+    if (l < len && h[l].t < h[m].t) m = l;
+    if (r < len && h[r].t < h[m].t) m = r;
+    if (m == i) return;
+    heap_swap(h, i, m);
+    i = m;
+  }
+}
+
+static bool event_valid(EventSim *s, Event *ev) {
+  if (ev->ca != s->count[ev->a]) return false;
+  return ev->type != EVENT_PAIR || ev->cb == s->count[ev->b];
+}
+
+// stale events are only dropped lazily, sweep them out when space runs low
+static void heap_purge(EventSim *s) {
+  size_t len = 0;
+  for (size_t i = 0; i < s->heap_len; i++) {
+    if (event_valid(s, &s->heap[i])) s->heap[len++] = s->heap[i];
+  }
+  s->heap_len = len;
+  for (size_t i = len / 2; i-- > 0;) heap_down(s->heap, len, i);
+}
+
+// a dense cluster can hold more live events than the initial guess, the
+// heap moves to twice the room further up the arena. the old copy is
+// only given back on the next reset
+static void heap_grow(EventSim *s) {
+  size_t cap = s->heap_cap ? 2 * s->heap_cap : EVENT_HEAP_PER_BODY;
+  Event *heap = arena_alloc_tagged(s->arena, cap * sizeof(Event),
+                                   "events heap");
+  memcpy(heap, s->heap, s->heap_len * sizeof(Event));
+  s->heap = heap;
+  s->heap_cap = cap;
+}
+
+static void heap_push(EventSim *s, Event ev) {
+  if (s->heap_len == s->heap_cap) {
+    heap_purge(s);
+    // mostly live events, purging again soon would not free much
+    if (s->heap_len * 4 >= s->heap_cap * 3) heap_grow(s);
+  }
+  s->heap[s->heap_len] = ev;
+  heap_up(s->heap, s->heap_len++);
+}
+
+static Event heap_pop(EventSim *s) {
+  Event top = s->heap[0];
+  s->heap[0] = s->heap[--s->heap_len];
+  heap_down(s->heap, s->heap_len, 0);
+  return top;
+}
+
+static void body_advance(EventSim *s, uint32_t i) {
+  Bodies *b = s->bodies;
+  double dt = s->t_now - s->t_body[i];
+  body_set_q(b, i, vec2add(body_q(b, i), vec2scale(dt, body_v(b, i))));
+  s->t_body[i] = s->t_now;
+}
+
+static uint32_t cell_coord(double x, double size, uint32_t n) {
+  double c = floor(x / size);
+  if (c < 0.0) return 0;
+  if (c >= (double) n) return n - 1;
+  return (uint32_t) c;
+}
+
+static void cell_link(EventSim *s, uint32_t i, uint32_t c) {
+  s->cell[i] = c;
+  s->prev[i] = EVENT_NO_BODY;
+  s->next[i] = s->heads[c];
+  if (s->heads[c] != EVENT_NO_BODY) s->prev[s->heads[c]] = i;
+  s->heads[c] = i;
+}
+
+static void cell_unlink(EventSim *s, uint32_t i) {
+  if (s->prev[i] != EVENT_NO_BODY) s->next[s->prev[i]] = s->next[i];
+  else s->heads[s->cell[i]] = s->next[i];
+  if (s->next[i] != EVENT_NO_BODY) s->prev[s->next[i]] = s->prev[i];
+}
+
+static double wall_time(double q, double v, double R, double hi) {
+  if (v < 0.0) return fmax(0.0, (R - q) / v);
+  if (v > 0.0) return fmax(0.0, (hi - R - q) / v);
+  return INFINITY;
+}
+
+static double cell_exit_time(double q, double v, double lo, double hi) {
+  if (v < 0.0) return fmax(0.0, (lo - q) / v);
+  if (v > 0.0) return fmax(0.0, (hi - q) / v);
+  return INFINITY;
+}
+
+static double pair_time(Bodies *b, uint32_t i, uint32_t j) {
+  vec2 d = vec2sub(body_q(b, j), body_q(b, i));
+  double R = b->R[i] + b->R[j];
+  // overlapping from the start, collide now if still closing in
+  if (vec2dot(d, d) <= R * R) {
+    vec2 w = vec2sub(body_v(b, j), body_v(b, i));
+    return vec2dot(d, w) < 0.0 ? 0.0 : TOI_NONE;
+  }
+  return toi_swept_circles(b, i, j, INFINITY);
+}
+
+static void predict_wall(EventSim *s, uint32_t i) {
+  Bodies *b = s->bodies;
+  double R  = b->R[i];
+  double tx = wall_time(b->x[i], b->vx[i], R, WIN_W);
+  double ty = wall_time(b->y[i], b->vy[i], R, WIN_H);
+  double t  = fmin(tx, ty);
+  if (t == INFINITY) return;
+  heap_push(s, (Event){
+    s->t_now + t, i, tx <= ty ? WALL_X : WALL_Y, s->count[i], 0, EVENT_WALL
+  });
+}
+
+// bodies are confined by the walls, so steps off the grid never happen
+static void predict_cell(EventSim *s, uint32_t i) {
+  Bodies *b = s->bodies;
+  uint32_t cx = s->cell[i] % s->cols, cy = s->cell[i] / s->cols;
+  double x0 = (double) cx * s->cell_size, y0 = (double) cy * s->cell_size;
+  double tx = cell_exit_time(b->x[i], b->vx[i], x0, x0 + s->cell_size);
+  double ty = cell_exit_time(b->y[i], b->vy[i], y0, y0 + s->cell_size);
+  cell_step_t step;
+  if (tx <= ty) {
+    step = b->vx[i] > 0.0 ? CELL_XP : CELL_XN;
+    if (step == CELL_XP ? cx + 1 >= s->cols : cx == 0) return;
+  } else {
+    step = b->vy[i] > 0.0 ? CELL_YP : CELL_YN;
+    if (step == CELL_YP ? cy + 1 >= s->rows : cy == 0) return;
+  }
+  double t = fmin(tx, ty);
+  if (t == INFINITY) return;
+  heap_push(s, (Event){ s->t_now + t, i, step, s->count[i], 0, EVENT_CELL });
+}
+
+// predicts i against every body in the given block of cells
+static void predict_pairs(EventSim *s, uint32_t i,
+                          int64_t x0, int64_t x1, int64_t y0, int64_t y1)
+{
+  if (x0 < 0) x0 = 0;
+  if (y0 < 0) y0 = 0;
+  if (x1 >= (int64_t) s->cols) x1 = (int64_t) s->cols - 1;
+  if (y1 >= (int64_t) s->rows) y1 = (int64_t) s->rows - 1;
+  for (int64_t y = y0; y <= y1; y++) {
+    for (int64_t x = x0; x <= x1; x++) {
+      uint32_t j = s->heads[(size_t) y * s->cols + (size_t) x];
+      for (; j != EVENT_NO_BODY; j = s->next[j]) {
+        if (j == i) continue;
+        body_advance(s, j);
+        double t = pair_time(s->bodies, i, j);
+        if (t == TOI_NONE) continue;
+        heap_push(s, (Event){
+          s->t_now + t, i, j, s->count[i], s->count[j], EVENT_PAIR
+        });
+      }
+    }
+  }
+}
+
+static void predict_body(EventSim *s, uint32_t i) {
+  int64_t cx = s->cell[i] % s->cols, cy = s->cell[i] / s->cols;
+  predict_wall(s, i);
+  predict_cell(s, i);
+  predict_pairs(s, i, cx - 1, cx + 1, cy - 1, cy + 1);
+}
+
+static void process_pair(EventSim *s, uint32_t a, uint32_t b) {
+  Bodies *bs = s->bodies;
+  body_advance(s, b);
+  bool tc = s->t_now - s->t_hit[a] < EVENT_TC
+         || s->t_now - s->t_hit[b] < EVENT_TC;
+  vec2 n = vec2norm(vec2sub(body_q(bs, b), body_q(bs, a)));
+  physics_collide_velocities(bs, a, b, n, tc ? 1.0 : s->e);
+  s->t_hit[a] = s->t_hit[b] = s->t_now;
+  s->count[a]++;
+  s->count[b]++;
+  predict_body(s, a);
+  predict_body(s, b);
+}
+
+static void process_wall(EventSim *s, uint32_t a, wall_t wall) {
+  Bodies *b = s->bodies;
+  double R = b->R[a];
+  if (wall == WALL_X) {
+    b->vx[a] *= -1;
+    b->x[a] = b->vx[a] > 0.0 ? R : WIN_W - R;
+  } else {
+    b->vy[a] *= -1;
+    b->y[a] = b->vy[a] > 0.0 ? R : WIN_H - R;
+  }
+  s->count[a]++;
+  predict_body(s, a);
+}
+
+// only the strip of cells that just came into reach needs new predictions
+static void process_cell(EventSim *s, uint32_t a, cell_step_t step) {
+  int64_t cx = s->cell[a] % s->cols, cy = s->cell[a] / s->cols;
+  switch (step) {
+  case CELL_XP: cx++; break;
+  case CELL_XN: cx--; break;
+  case CELL_YP: cy++; break;
+  case CELL_YN: cy--; break;
+  }
+  cell_unlink(s, a);
+  cell_link(s, a, (uint32_t)(cy * s->cols + cx));
+  predict_cell(s, a);
+  switch (step) {
+  case CELL_XP: predict_pairs(s, a, cx + 1, cx + 1, cy - 1, cy + 1); break;
+  case CELL_XN: predict_pairs(s, a, cx - 1, cx - 1, cy - 1, cy + 1); break;
+  case CELL_YP: predict_pairs(s, a, cx - 1, cx + 1, cy + 1, cy + 1); break;
+  case CELL_YN: predict_pairs(s, a, cx - 1, cx + 1, cy - 1, cy - 1); break;
+  }
+}
+
+static size_t events_bytes(EventSim *s, size_t n) {
+  return n * (2 * sizeof(double) + 4 * sizeof(uint32_t))
+       + n * EVENT_HEAP_PER_BODY * sizeof(Event)
+       + s->max_cells * sizeof(uint32_t);
+}
+
+// max_bodies only sizes the initial commit, the arena grows past it
+EventSim *events_init(size_t max_bodies, double e, page_strat_t strat) {
+  EventSim *s = (EventSim *) calloc(1, sizeof(EventSim));
+  if (s == NULL) PANIC_WITH(EVENT_ALLOC_FAIL);
+  s->max_cells = (size_t) ceil(WIN_W / EVENT_MIN_CELL)
+               * (size_t) ceil(WIN_H / EVENT_MIN_CELL);
+  s->e = e;
+  s->arena = arena_init(events_bytes(s, max_bodies), strat);
+  return s;
+}
+
+// the body enters the grid at the current time with a clean history
+static void body_join(EventSim *s, uint32_t i) {
+  Bodies *b = s->bodies;
+  double R = b->R[i];
+  b->x[i] = fmin(fmax(b->x[i], R), WIN_W - R);
+  b->y[i] = fmin(fmax(b->y[i], R), WIN_H - R);
+  s->t_body[i] = s->t_now;
+  s->t_hit[i] = -INFINITY;
+  s->count[i] = 0;
+  uint32_t cx = cell_coord(b->x[i], s->cell_size, s->cols);
+  uint32_t cy = cell_coord(b->y[i], s->cell_size, s->rows);
+  cell_link(s, i, cy * s->cols + cx);
+}
+
+// rebuilds every schedule from the bodies' current state, time restarts
+// at 0. the per-body arrays get room to spare for events_add
+void events_reset(EventSim *s, Bodies *b) {
+  size_t n = b->len;
+  s->heap_cap = n * EVENT_HEAP_PER_BODY;
+  s->body_cap = n < EVENT_MIN_BODIES ? 2 * EVENT_MIN_BODIES : 2 * n;
+  arena_reset(s->arena);
+  s->bodies = b;
+  s->n = n;
+  s->t_now = 0.0;
+  s->processed = 0;
+  s->heap_len = 0;
+
+  double R_max = 0.0;
+  for (size_t i = 0; i < n; i++) R_max = fmax(R_max, b->R[i]);
+  s->cell_size = fmax(2.0 * R_max, EVENT_MIN_CELL);
+  s->cols = (uint32_t) ceil(WIN_W / s->cell_size);
+  s->rows = (uint32_t) ceil(WIN_H / s->cell_size);
+
+  MemoryArena *a = s->arena;
+  size_t cap = s->body_cap;
+  s->t_body = arena_alloc_tagged(a, cap * sizeof(double), "events body");
+  s->t_hit  = arena_alloc_tagged(a, cap * sizeof(double), "events body");
+  s->heap   = arena_alloc_tagged(a, s->heap_cap * sizeof(Event), "events heap");
+  s->count  = arena_alloc_tagged(a, cap * sizeof(uint32_t), "events body");
+  s->cell   = arena_alloc_tagged(a, cap * sizeof(uint32_t), "events cell");
+  s->next   = arena_alloc_tagged(a, cap * sizeof(uint32_t), "events cell");
+  s->prev   = arena_alloc_tagged(a, cap * sizeof(uint32_t), "events cell");
+  s->heads  = arena_alloc_tagged(a,
+                                 (size_t) s->cols * s->rows * sizeof(uint32_t),
+                                 "events cell");
+  for (size_t c = 0; c < (size_t) s->cols * s->rows; c++) {
+    s->heads[c] = EVENT_NO_BODY;
+  }
+
+  for (uint32_t i = 0; i < n; i++) body_join(s, i);
+  for (uint32_t i = 0; i < n; i++) predict_body(s, i);
+}
+
+// bodies [n, len) were appended to the same store and join at the current
+// time, nobody else is rescheduled. out of room, or a body too large for
+// the grid, and everything is reset instead
+void events_add(EventSim *s, Bodies *b) {
+  size_t len = b->len;
+  bool fits = b == s->bodies && len <= s->body_cap;
+  for (size_t i = s->n; fits && i < len; i++) {
+    fits = 2.0 * b->R[i] <= s->cell_size;
+  }
+  if (!fits) {
+    events_reset(s, b);
+    return;
+  }
+  uint32_t first = (uint32_t) s->n;
+  s->n = len;
+  for (uint32_t i = first; i < len; i++) body_join(s, i);
+  for (uint32_t i = first; i < len; i++) predict_body(s, i);
+}
+
+void events_run(EventSim *s, double dt) {
+  double t_end = s->t_now + dt;
+  while (s->heap_len > 0 && s->heap[0].t <= t_end) {
+    Event ev = heap_pop(s);
+    if (!event_valid(s, &ev)) continue;
+    s->t_now = ev.t;
+    body_advance(s, ev.a);
+    switch (ev.type) {
+    case EVENT_PAIR: process_pair(s, ev.a, ev.b); break;
+    case EVENT_WALL: process_wall(s, ev.a, (wall_t) ev.b); break;
+    case EVENT_CELL: process_cell(s, ev.a, (cell_step_t) ev.b); break;
+    }
+    s->processed++;
+  }
+  s->t_now = t_end;
+}
+
+// brings every body to the current time, needed before drawing
+void events_sync(EventSim *s) {
+  for (uint32_t i = 0; i < s->n; i++) body_advance(s, i);
+}
+
+void events_free(EventSim *s) {
+  if (s == NULL) return;
+  arena_free(s->arena);
+  free(s);
+}
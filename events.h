@@ -0,0 +1,64 @@
+#ifndef EVENTS_H_
+#define EVENTS_H_
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "physics.h"
+#include "alloc.h"
+
+#define EVENT_HEAP_PER_BODY 32
+#define EVENT_MIN_BODIES    256  // per-body room never sized below this
+#define EVENT_MIN_CELL      8.0
+#define EVENT_TC            1e-5  // faster repeat contacts are elastic
+#define EVENT_NO_BODY       UINT32_MAX
+
+typedef enum { EVENT_PAIR, EVENT_WALL, EVENT_CELL } event_t;
+
+typedef enum { WALL_X, WALL_Y } wall_t;
+typedef enum { CELL_XP, CELL_XN, CELL_YP, CELL_YN } cell_step_t;
+
+// an event is stale once either body's count moved past the snapshot
+typedef struct {
+  double t;
+  uint32_t a;
+  uint32_t b;       // partner body, wall_t or cell_step_t
+  uint32_t ca, cb;  // collision counts when predicted
+  event_t type;
+} Event;
+
+// free flight between events, bodies are only advanced when touched
+typedef struct {
+  MemoryArena *arena;
+  size_t max_cells;
+  Bodies *bodies;
+  size_t n;
+  size_t body_cap;    // bodies the per-body arrays have room for
+  double t_now;
+  double e;
+  size_t processed;
+
+  double *t_body;     // time at which each body's q is current
+  double *t_hit;      // last collision time, for the TC model
+  uint32_t *count;
+  uint32_t *cell;
+  uint32_t *next;
+  uint32_t *prev;
+
+  double cell_size;   // at least one body diameter
+  uint32_t cols, rows;
+  uint32_t *heads;
+
+  size_t heap_len;
+  size_t heap_cap;
+  Event *heap;
+} EventSim;
+
+EventSim *events_init(size_t max_bodies, double e, page_strat_t strat);
+void events_reset(EventSim *, Bodies *);
+void events_add(EventSim *, Bodies *);
+void events_run(EventSim *, double);
+void events_sync(EventSim *);
+void events_free(EventSim *);
+
+#endif // EVENTS_H_
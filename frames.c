@@ -1,6 +1,7 @@
 #include <time.h>
 #include <GLFW/glfw3.h>
 #include "frames.h"
+#include "alloc.h"
 
 static double FRAME_TIME0         = 0.0f;
 static double TARGET_FPS          = DEFAULT_FPS;
@@ -9,14 +10,17 @@ static double TARGET_FRAME_PERIOD = (1.0f / DEFAULT_FPS);
 void BEGIN_FRAME(void) { FRAME_TIME0 = glfwGetTime(); }
 
 void END_FRAME(void) {
+  TRACE_FRAME_END();
   double dt = glfwGetTime() - FRAME_TIME0;
-  if (dt < TARGET_FRAME_PERIOD) {
-    double sleep_until = TARGET_FRAME_PERIOD - dt;
-    nanosleep(&(struct timespec) {
-        .tv_nsec = (int64_t)((TARGET_FRAME_PERIOD - dt) * 1e9),
-        .tv_sec  = (time_t) sleep_until,
-      }, NULL);
-  }
+  if (dt < TARGET_FRAME_PERIOD) FRAME_SLEEP(TARGET_FRAME_PERIOD - dt);
+}
+
+void FRAME_SLEEP(double secs) {
+  if (secs <= 0.0) return;
+  nanosleep(&(struct timespec) {
+      .tv_sec  = (time_t) secs,
+      .tv_nsec = (int64_t)((secs - (double)(time_t) secs) * 1e9),
+    }, NULL);
 }
 
 void FRAME_TARGET_FPS(uint16_t fps) {
@@ -6,6 +6,7 @@
 
 void BEGIN_FRAME(void);
 void END_FRAME(void);
+void FRAME_SLEEP(double);
 
 void FRAME_TARGET_FPS(uint16_t);
 double GET_TARGET_FPS(void);
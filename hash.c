@@ -0,0 +1,199 @@
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+
+#include "hash.h"
+#include "log.h"
+
+static const int32_t FORWARD_NEIGHBORS[4][2] = {
+  {1, 0}, {1, 1}, {0, 1}, {-1, 1},
+};
+
+static uint64_t cell_key_of(SpatialHash *h, vec2 q) {
+  return hash_cell_key((int32_t) floor(q.x / h->sector_size),
+                       (int32_t) floor(q.y / h->sector_size));
+}
+
+static HashCell *cells_alloc(size_t cap) {
+  HashCell *cells = (HashCell *) calloc(cap, sizeof(HashCell));
+  if (cells == NULL) PANIC_WITH(HASH_ALLOC_FAIL);
+  return cells;
+}
+
+static size_t cell_find(SpatialHash *h, uint64_t key) {
+  const size_t mask = h->cap - 1;
+  for (size_t s = hash_func(key, h->cap);; s = (s + 1) & mask) {
+    if (h->cells[s].count == 0) return SIZE_MAX;
+    if (h->cells[s].key == key) return s;
+  }
+}
+
+static void cells_rehash(SpatialHash *h, size_t new_cap) {
+  HashCell *old = h->cells;
+  size_t old_cap = h->cap;
+  h->cells = cells_alloc(new_cap);
+  h->cap = new_cap;
+  for (size_t s = 0; s < old_cap; s++) {
+    if (old[s].count == 0) continue;
+    size_t t = hash_func(old[s].key, new_cap);
+    while (h->cells[t].count != 0) t = (t + 1) & (new_cap - 1);
+    h->cells[t] = old[s];
+  }
+  free(old);
+}
+
+static size_t cell_acquire(SpatialHash *h, uint64_t key) {
+  size_t s = cell_find(h, key);
+  if (s != SIZE_MAX) return s;
+  if ((h->num_cells + 1) * 2 > h->cap) cells_rehash(h, h->cap * 2);
+  s = hash_func(key, h->cap);
+  while (h->cells[s].count != 0) s = (s + 1) & (h->cap - 1);
+  h->cells[s] = (HashCell){ key, HASH_NO_BODY, 0 };
+  h->num_cells++;
+  return s;
+}
+
+// backward-shift deletion, keeps probe chains intact without tombstones
+static void cell_release(SpatialHash *h, size_t slot) {
+  const size_t mask = h->cap - 1;
+  size_t i = slot, j = slot;
+  for (;;) {
+    j = (j + 1) & mask;
+    if (h->cells[j].count == 0) break;
+    size_t k = hash_func(h->cells[j].key, h->cap);
+    bool stays = (i <= j) ? (i < k && k <= j) : (i < k || k <= j);
+    if (stays) continue;
+    h->cells[i] = h->cells[j];
+    i = j;
+  }
+  h->cells[i].count = 0;
+  h->num_cells--;
+  if (h->cap > HASH_MIN_CAP && h->num_cells * 8 < h->cap) {
+    cells_rehash(h, h->cap / 2);
+  }
+}
+
+static void body_link(SpatialHash *h, uint32_t i, uint64_t key) {
+  size_t slot = cell_acquire(h, key); // may rehash, index cells after
+  HashCell *cell = &h->cells[slot];
+  h->next[i] = cell->head;
+  h->prev[i] = HASH_NO_BODY;
+  if (cell->head != HASH_NO_BODY) h->prev[cell->head] = i;
+  cell->head = i;
+  cell->count++;
+  h->cell_of[i] = key;
+}
+
+static void body_unlink(SpatialHash *h, uint32_t i) {
+  size_t slot = cell_find(h, h->cell_of[i]);
+  if (slot == SIZE_MAX) PANIC_WITH(HASH_MISSING_CELL);
+  HashCell *cell = &h->cells[slot];
+  if (h->prev[i] != HASH_NO_BODY) h->next[h->prev[i]] = h->next[i];
+  else cell->head = h->next[i];
+  if (h->next[i] != HASH_NO_BODY) h->prev[h->next[i]] = h->prev[i];
+  if (--cell->count == 0) cell_release(h, slot);
+}
+
+static void entries_reserve(SpatialHash *h, size_t n) {
+  if (n <= h->entry_cap) return;
+  size_t cap = h->entry_cap ? h->entry_cap : 256;
+  while (cap < n) cap *= 2;
+  if (cap > HASH_NO_BODY) PANIC_WITH(HASH_ALLOC_FAIL);
+  h->cell_of = realloc(h->cell_of, cap * sizeof(uint64_t));
+  h->next    = realloc(h->next,    cap * sizeof(uint32_t));
+  h->prev    = realloc(h->prev,    cap * sizeof(uint32_t));
+  if (!h->cell_of || !h->next || !h->prev) PANIC_WITH(HASH_ALLOC_FAIL);
+  h->entry_cap = cap;
+}
+
+SpatialHash *init_spatial_hash(double sector_size, Bodies *bodies) {
+  if (sector_size <= 0) PANIC_WITH(HASH_INIT_FAIL);
+
+  SpatialHash *hash_table = (SpatialHash *) calloc(1, sizeof(SpatialHash));
+  if (hash_table == NULL) PANIC_WITH(HASH_INIT_FAIL);
+
+  hash_table->sector_size = sector_size;
+  hash_table->bodies = bodies;
+  hash_table->cap = HASH_MIN_CAP;
+  hash_table->cells = cells_alloc(HASH_MIN_CAP);
+  return hash_table;
+}
+
+// bodies are added in index order, the next one is body num_entries
+void add_entity_to_spatial_hash(SpatialHash *h, uint32_t body) {
+  entries_reserve(h, (size_t) body + 1);
+  h->num_entries = (size_t) body + 1;
+  body_link(h, body, cell_key_of(h, body_q(h->bodies, body)));
+}
+
+// only bodies whose cell changed since the last update are touched
+size_t spatial_hash_update(SpatialHash *h) {
+  size_t moved = 0;
+  for (uint32_t i = 0; i < h->num_entries; i++) {
+    uint64_t key = cell_key_of(h, body_q(h->bodies, i));
+    if (key == h->cell_of[i]) continue;
+    body_unlink(h, i);
+    body_link(h, i, key);
+    moved++;
+  }
+  return moved;
+}
+
+// follows entities_compact, entries are in body order: the tail past len
+// leaves or takes over the hole a removed body left below it
+void spatial_hash_compact(SpatialHash *h, const uint32_t *to, size_t len) {
+  for (uint32_t k = (uint32_t) len; k < h->num_entries; k++) {
+    uint64_t key = h->cell_of[k];
+    body_unlink(h, k);
+    if (to[k] == BODY_REMOVED) continue;
+    body_unlink(h, to[k]);
+    body_link(h, to[k], key);
+  }
+  h->num_entries = len;
+}
+
+// capacity is kept, refilling after a despawn must not allocate
+void spatial_hash_clear(SpatialHash *h) {
+  memset(h->cells, 0, h->cap * sizeof(HashCell));
+  h->num_cells = 0;
+  h->num_entries = 0;
+}
+
+void spatial_hash_free(SpatialHash *h) {
+  if (h == NULL) return;
+  free(h->cells);
+  free(h->cell_of);
+  free(h->next);
+  free(h->prev);
+  free(h);
+}
+
+static void cell_pairs(SpatialHash *h, HashCell *c1, HashCell *c2,
+                       pair_fn fn, void *ctx)
+{
+  for (uint32_t a = c1->head; a != HASH_NO_BODY; a = h->next[a]) {
+    uint32_t b = (c1 == c2) ? h->next[a] : c2->head;
+    for (; b != HASH_NO_BODY; b = h->next[b]) {
+      fn(h->bodies, a, b, ctx);
+    }
+  }
+}
+
+// each unordered pair of neighboring bodies is visited exactly once
+void spatial_hash_for_each_pair(SpatialHash *h, pair_fn fn, void *ctx) {
+  for (size_t s = 0; s < h->cap; s++) {
+    HashCell *cell = &h->cells[s];
+    if (cell->count == 0) continue;
+    cell_pairs(h, cell, cell, fn, ctx);
+    int32_t x = hash_key_x(cell->key), y = hash_key_y(cell->key);
+    for (size_t d = 0; d < 4; d++) {
+      size_t n = cell_find(h, hash_cell_key(x + FORWARD_NEIGHBORS[d][0],
+                                            y + FORWARD_NEIGHBORS[d][1]));
+      if (n != SIZE_MAX) cell_pairs(h, cell, &h->cells[n], fn, ctx);
+    }
+  }
+}
+
+void spatial_hash_apply_collisions(SpatialHash *h) {
+  spatial_hash_for_each_pair(h, pair_impulsive_collision, NULL);
+}
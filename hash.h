@@ -0,0 +1,57 @@
+#ifndef HASH_H_
+#define HASH_H_
+#include <stdint.h>
+#include <stddef.h>
+
+#include "physics.h"
+
+#define HASH_MIN_CAP  64
+#define HASH_NO_BODY  UINT32_MAX
+
+// open addressing, linear probing; a slot is empty iff count == 0
+typedef struct {
+  uint64_t key;   // packed (x, y) cell coordinates
+  uint32_t head;  // first body in the cell's intrusive list
+  uint32_t count;
+} HashCell;
+
+typedef struct SpatialHash {
+  double sector_size;   // must be >= largest body diameter
+  size_t cap;           // always a power of two
+  size_t num_cells;     // occupied cells
+  size_t num_entries;
+  size_t entry_cap;
+  HashCell *cells;
+  Bodies *bodies;       // entry i is body i
+  uint64_t *cell_of;    // per-body current cell key
+  uint32_t *next;
+  uint32_t *prev;
+} SpatialHash;
+
+static inline uint64_t hash_cell_key(int32_t x, int32_t y) {
+  return ((uint64_t)(uint32_t)x << 32) | (uint64_t)(uint32_t)y;
+}
+
+static inline int32_t hash_key_x(uint64_t key) { return (int32_t)(key >> 32); }
+static inline int32_t hash_key_y(uint64_t key) {
+  return (int32_t)(key & 0xFFFFFFFF);
+}
+
+// fibonacci hashing, the top log2(cap) bits of the product index the
+// table. cap is a power of two, at least HASH_MIN_CAP
+static inline size_t hash_func(uint64_t key, size_t cap) {
+  uint64_t h = key * 0x9E3779B97F4A7C15ull;
+  return (size_t)(h >> (64 - __builtin_ctzll((unsigned long long) cap)));
+}
+
+SpatialHash *init_spatial_hash(double sector_size, Bodies *);
+void add_entity_to_spatial_hash(SpatialHash *, uint32_t);
+size_t spatial_hash_update(SpatialHash *);
+void spatial_hash_compact(SpatialHash *, const uint32_t *, size_t);
+void spatial_hash_clear(SpatialHash *);
+void spatial_hash_free(SpatialHash *);
+
+void spatial_hash_for_each_pair(SpatialHash *, pair_fn, void *);
+void spatial_hash_apply_collisions(SpatialHash *);
+
+#endif // HASH_H_
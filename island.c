@@ -0,0 +1,261 @@
+#include <string.h>
+
+#include "island.h"
+#include "log.h"
+
+#define SPAN_CHUNK 64
+
+static void *island_worker(void *arg) {
+  IslandWorker *w = (IslandWorker *) arg;
+  IslandSolver *s = w->solver;
+  size_t seen = 0;
+  for (;;) {
+    pthread_mutex_lock(&s->lock);
+    while (s->generation == seen && !s->quit) {
+      pthread_cond_wait(&s->wake, &s->lock);
+    }
+    if (s->quit) { pthread_mutex_unlock(&s->lock); return NULL; }
+    seen = s->generation;
+    island_task task = s->task;
+    pthread_mutex_unlock(&s->lock);
+
+    task(s, w->id);
+
+    pthread_mutex_lock(&s->lock);
+    if (--s->running == 0) pthread_cond_signal(&s->done);
+    pthread_mutex_unlock(&s->lock);
+  }
+}
+
+// the calling thread takes part as worker 0
+static void parallel_run(IslandSolver *s, island_task task) {
+  atomic_store(&s->cursor, 0);
+  pthread_mutex_lock(&s->lock);
+  s->task = task;
+  s->running = s->num_workers - 1;
+  s->generation++;
+  pthread_cond_broadcast(&s->wake);
+  pthread_mutex_unlock(&s->lock);
+
+  task(s, 0);
+
+  pthread_mutex_lock(&s->lock);
+  while (s->running > 0) pthread_cond_wait(&s->done, &s->lock);
+  pthread_mutex_unlock(&s->lock);
+}
+
+IslandSolver *islands_init(size_t num_workers) {
+  IslandSolver *s = (IslandSolver *) calloc(1, sizeof(IslandSolver));
+  if (s == NULL) PANIC_WITH(ISLAND_ALLOC_FAIL);
+  s->num_workers = num_workers > 0 ? num_workers : 1;
+  pthread_mutex_init(&s->lock, NULL);
+  pthread_cond_init(&s->wake, NULL);
+  pthread_cond_init(&s->done, NULL);
+  s->threads = (pthread_t *) calloc(s->num_workers, sizeof(pthread_t));
+  s->workers = (IslandWorker *) calloc(s->num_workers, sizeof(IslandWorker));
+  if (!s->threads || !s->workers) PANIC_WITH(ISLAND_ALLOC_FAIL);
+  for (size_t w = 1; w < s->num_workers; w++) {
+    s->workers[w] = (IslandWorker){ s, w };
+    if (pthread_create(&s->threads[w], NULL, island_worker, &s->workers[w]))
+      PANIC_WITH(ISLAND_THREAD_FAIL);
+  }
+  return s;
+}
+
+void islands_free(IslandSolver *s) {
+  if (s == NULL) return;
+  pthread_mutex_lock(&s->lock);
+  s->quit = true;
+  pthread_cond_broadcast(&s->wake);
+  pthread_mutex_unlock(&s->lock);
+  for (size_t w = 1; w < s->num_workers; w++) pthread_join(s->threads[w], NULL);
+  pthread_mutex_destroy(&s->lock);
+  pthread_cond_destroy(&s->wake);
+  pthread_cond_destroy(&s->done);
+  free(s->threads);   free(s->workers);
+  free(s->parent);    free(s->offset);  free(s->color_mask);
+  free(s->order);     free(s->scratch); free(s->color_of);
+  free(s->islands);
+  free(s);
+}
+
+static void islands_reserve(IslandSolver *s, size_t bodies, size_t contacts) {
+  if (bodies > s->body_cap) {
+    s->body_cap   = bodies;
+    s->parent     = realloc(s->parent, bodies * sizeof(uint32_t));
+    s->offset     = realloc(s->offset, bodies * sizeof(uint32_t));
+    s->color_mask = realloc(s->color_mask, bodies * sizeof(uint64_t));
+    if (!s->parent || !s->offset || !s->color_mask)
+      PANIC_WITH(ISLAND_ALLOC_FAIL);
+    memset(s->color_mask, 0, bodies * sizeof(uint64_t));
+  }
+  if (contacts > s->contact_cap) {
+    s->contact_cap = contacts;
+    s->order    = realloc(s->order, contacts * sizeof(uint32_t));
+    s->scratch  = realloc(s->scratch, contacts * sizeof(uint32_t));
+    s->color_of = realloc(s->color_of, contacts * sizeof(uint8_t));
+    s->islands  = realloc(s->islands, contacts * sizeof(Island));
+    if (!s->order || !s->scratch || !s->color_of || !s->islands)
+      PANIC_WITH(ISLAND_ALLOC_FAIL);
+  }
+}
+
+static uint32_t uf_find(uint32_t *parent, uint32_t x) {
+  while (parent[x] != x) {
+    parent[x] = parent[parent[x]];  // path halving
+    x = parent[x];
+  }
+  return x;
+}
+
+static void uf_union(uint32_t *parent, uint32_t a, uint32_t b) {
+  a = uf_find(parent, a);
+  b = uf_find(parent, b);
+  if (a < b) parent[b] = a;
+  else if (b < a) parent[a] = b;
+}
+
+static int island_cmp(const void *p1, const void *p2) {
+  const Island *i1 = (const Island *) p1, *i2 = (const Island *) p2;
+  return (i1->len < i2->len) - (i1->len > i2->len);
+}
+
+static void islands_build(IslandSolver *s, size_t N) {
+  ContactBuffer *cb = s->cb;
+  for (uint32_t n = 0; n < N; n++) { s->parent[n] = n; s->offset[n] = 0; }
+  for (size_t k = 0; k < cb->len; k++) {
+    uf_union(s->parent, cb->data[k].a, cb->data[k].b);
+  }
+  for (size_t k = 0; k < cb->len; k++) {
+    s->offset[uf_find(s->parent, cb->data[k].a)]++;
+  }
+
+  uint32_t start = 0;
+  s->num_islands = 0;
+  for (uint32_t n = 0; n < N; n++) {
+    uint32_t len = s->offset[n];
+    if (len == 0) continue;
+    s->islands[s->num_islands++] = (Island){ start, len };
+    s->offset[n] = start;
+    start += len;
+  }
+  for (uint32_t k = 0; k < cb->len; k++) {
+    uint32_t root = uf_find(s->parent, cb->data[k].a);
+    s->order[s->offset[root]++] = k;
+  }
+
+  // largest first so the long tail of tiny islands balances the workers
+  qsort(s->islands, s->num_islands, sizeof(Island), island_cmp);
+  s->num_small = 0;
+  while (s->num_small < s->num_islands
+         && s->islands[s->num_islands - 1 - s->num_small].len
+            <= ISLAND_SPLIT_SIZE) s->num_small++;
+}
+
+static void solve_small_islands(IslandSolver *s, size_t worker) {
+  (void) worker;
+  const size_t first = s->num_islands - s->num_small;
+  for (;;) {
+    size_t k = atomic_fetch_add(&s->cursor, 1);
+    if (k >= s->num_small) return;
+    Island isl = s->islands[first + k];
+    contacts_iterate(s->cb, s->order + isl.start, isl.len, s->iterations);
+    contacts_correct(s->cb, s->order + isl.start, isl.len);
+  }
+}
+
+static void iterate_span(IslandSolver *s, size_t worker) {
+  (void) worker;
+  for (;;) {
+    size_t k = atomic_fetch_add(&s->cursor, SPAN_CHUNK);
+    if (k >= s->span_len) return;
+    size_t n = s->span_len - k < SPAN_CHUNK ? s->span_len - k : SPAN_CHUNK;
+    contacts_iterate(s->cb, s->span + k, n, 1);
+  }
+}
+
+static void correct_span(IslandSolver *s, size_t worker) {
+  (void) worker;
+  for (;;) {
+    size_t k = atomic_fetch_add(&s->cursor, SPAN_CHUNK);
+    if (k >= s->span_len) return;
+    size_t n = s->span_len - k < SPAN_CHUNK ? s->span_len - k : SPAN_CHUNK;
+    contacts_correct(s->cb, s->span + k, n);
+  }
+}
+
+// greedy edge coloring, no two contacts of one color share a body; the
+// last color is a catch-all that is solved serially
+static size_t color_island(IslandSolver *s, Island isl) {
+  ContactBuffer *cb = s->cb;
+  const uint32_t *idx = s->order + isl.start;
+  uint32_t count[ISLAND_MAX_COLORS] = {0};
+  size_t num_colors = 0;
+  for (size_t k = 0; k < isl.len; k++) {
+    Contact *c = &cb->data[idx[k]];
+    uint64_t *ma = &s->color_mask[c->a];
+    uint64_t *mb = &s->color_mask[c->b];
+    uint64_t used = *ma | *mb;
+    uint8_t color = ISLAND_MAX_COLORS - 1;
+    for (uint8_t b = 0; b < ISLAND_MAX_COLORS - 1; b++) {
+      if (!(used & (1ull << b))) { color = b; break; }
+    }
+    *ma |= 1ull << color; *mb |= 1ull << color;
+    s->color_of[k] = color;
+    count[color]++;
+    if ((size_t) color + 1 > num_colors) num_colors = (size_t) color + 1;
+  }
+  uint32_t start = 0;
+  for (size_t c = 0; c < num_colors; c++) {
+    s->colors[c] = (Island){ start, 0 };
+    start += count[c];
+  }
+  for (size_t k = 0; k < isl.len; k++) {
+    Island *col = &s->colors[s->color_of[k]];
+    s->scratch[col->start + col->len++] = idx[k];
+    Contact *c = &cb->data[idx[k]];
+    s->color_mask[c->a] = 0;
+    s->color_mask[c->b] = 0;
+  }
+  return num_colors;
+}
+
+static void solve_large_island(IslandSolver *s, Island isl) {
+  size_t num_colors = color_island(s, isl);
+  const Island catch_all = s->colors[ISLAND_MAX_COLORS - 1];
+  size_t parallel_colors = num_colors < ISLAND_MAX_COLORS
+                         ? num_colors : ISLAND_MAX_COLORS - 1;
+  for (size_t it = 0; it < s->iterations; it++) {
+    for (size_t c = 0; c < parallel_colors; c++) {
+      s->span = s->scratch + s->colors[c].start;
+      s->span_len = s->colors[c].len;
+      parallel_run(s, iterate_span);
+    }
+    if (num_colors == ISLAND_MAX_COLORS) {
+      contacts_iterate(s->cb, s->scratch + catch_all.start, catch_all.len, 1);
+    }
+  }
+  for (size_t c = 0; c < parallel_colors; c++) {
+    s->span = s->scratch + s->colors[c].start;
+    s->span_len = s->colors[c].len;
+    parallel_run(s, correct_span);
+  }
+  if (num_colors == ISLAND_MAX_COLORS) {
+    contacts_correct(s->cb, s->scratch + catch_all.start, catch_all.len);
+  }
+}
+
+void islands_solve(IslandSolver *s, ContactBuffer *cb, size_t N,
+                   size_t iterations, double e)
+{
+  contacts_prepare(cb, e);
+  if (cb->len == 0) return;
+  s->cb = cb;
+  s->iterations = iterations;
+  islands_reserve(s, N, cb->len);
+  islands_build(s, N);
+  for (size_t k = 0; k < s->num_islands - s->num_small; k++) {
+    solve_large_island(s, s->islands[k]);
+  }
+  if (s->num_small > 0) parallel_run(s, solve_small_islands);
+}
@@ -0,0 +1,60 @@
+#ifndef ISLAND_H_
+#define ISLAND_H_
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "physics.h"
+#include "contact.h"
+
+#define ISLAND_SPLIT_SIZE 512  // islands above this many contacts get colored
+#define ISLAND_MAX_COLORS 64
+
+typedef struct { uint32_t start, len; } Island;
+
+struct IslandSolver;
+typedef void (*island_task)(struct IslandSolver *, size_t worker);
+
+typedef struct IslandWorker {
+  struct IslandSolver *solver;
+  size_t id;
+} IslandWorker;
+
+// bodies touched by one island are never touched by another, so islands
+// can be solved concurrently without locks
+typedef struct IslandSolver {
+  size_t num_workers;
+  pthread_t *threads;
+  IslandWorker *workers;
+  pthread_mutex_t lock;
+  pthread_cond_t wake, done;
+  size_t generation;
+  size_t running;
+  bool quit;
+  island_task task;
+  atomic_size_t cursor;
+
+  ContactBuffer *cb;
+  size_t iterations;
+  size_t body_cap;
+  uint32_t *parent;      // union-find forest over bodies
+  uint32_t *offset;      // per-root island offset into order
+  uint64_t *color_mask;  // per-body colors in use while coloring
+  size_t contact_cap;
+  uint32_t *order;       // contact indices grouped by island
+  uint32_t *scratch;     // a large island's contacts grouped by color
+  uint8_t *color_of;
+  size_t num_islands, num_small;
+  Island *islands;       // largest first, the num_small small ones last
+  Island colors[ISLAND_MAX_COLORS];
+  const uint32_t *span;  // contacts currently shared out across workers
+  size_t span_len;
+} IslandSolver;
+
+IslandSolver *islands_init(size_t);
+void islands_solve(IslandSolver *, ContactBuffer *, size_t, size_t, double);
+void islands_free(IslandSolver *);
+
+#endif // ISLAND_H_
@@ -0,0 +1,81 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "isolate.h"
+#include "log.h"
+
+static void isolate_report(bool ok, const char *what, const char *name,
+                           int err)
+{
+  if (ok) {
+    printf(COLOR_GREEN"[ISOLATE]"COLOR_RESET" %s: %s\n", name, what);
+  } else {
+    printf(COLOR_YELLOW"[ISOLATE]"COLOR_RESET" %s: %s failed (%s)\n", name,
+           what, strerror(err));
+  }
+}
+
+// the mask is read back, the kernel may refuse a core without failing
+bool isolate_pin(pthread_t thread, const char *name, int core) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  int err = EINVAL;
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  if (core >= 0 && core < cores && core < CPU_SETSIZE) {
+    CPU_SET((size_t) core, &set);
+    err = pthread_setaffinity_np(thread, sizeof(set), &set);
+  }
+  if (err == 0) {
+    cpu_set_t got;
+    err = pthread_getaffinity_np(thread, sizeof(got), &got);
+    if (err == 0 && !CPU_EQUAL(&set, &got)) err = EINVAL;
+  }
+  char what[32];
+  snprintf(what, sizeof(what), "pinned to core %d", core);
+  isolate_report(err == 0, what, name, err);
+  return err == 0;
+}
+
+bool isolate_fifo(pthread_t thread, const char *name, int prio) {
+  struct sched_param param = { .sched_priority = prio };
+  int err = pthread_setschedparam(thread, SCHED_FIFO, &param);
+  if (err == 0) {
+    int policy;
+    err = pthread_getschedparam(thread, &policy, &param);
+    if (err == 0 && policy != SCHED_FIFO) err = EPERM;
+  }
+  char what[32];
+  snprintf(what, sizeof(what), "SCHED_FIFO at %d", prio);
+  isolate_report(err == 0, what, name, err);
+  return err == 0;
+}
+
+bool isolate_thread(pthread_t thread, const char *name, int core, int prio) {
+  bool pinned = isolate_pin(thread, name, core);
+  bool fifo = isolate_fifo(thread, name, prio);
+  return pinned && fifo;
+}
+
+// every mapping the process has and every one it makes from now on,
+// heap, thread stacks and pages committed later included
+bool isolate_process(void) {
+  bool ok = mlockall(MCL_CURRENT | MCL_FUTURE) == 0;
+  isolate_report(ok, "all pages locked, now and future", "process", errno);
+  return ok;
+}
+
+bool isolate_arena(MemoryArena *arena, const char *name) {
+  bool ok = arena_lock(arena);
+  isolate_report(ok, "pages locked", name, errno);
+  return ok;
+}
+
+bool isolate_entities(EntityArray *ea, const char *name) {
+  bool ok = entities_lock(ea);
+  isolate_report(ok, "pages locked", name, errno);
+  return ok;
+}
@@ -0,0 +1,19 @@
+#ifndef ISOLATE_H_
+#define ISOLATE_H_
+#include <pthread.h>
+#include <stdbool.h>
+
+#include "alloc.h"
+#include "entities.h"
+
+// best effort, every call reports what did and did not take effect and
+// carries on either way. FIFO and memory locking usually need root or
+// CAP_SYS_NICE / CAP_IPC_LOCK, pinning works unprivileged
+bool isolate_pin(pthread_t, const char *, int);
+bool isolate_fifo(pthread_t, const char *, int);
+bool isolate_thread(pthread_t, const char *, int, int);
+bool isolate_process(void);
+bool isolate_arena(MemoryArena *, const char *);
+bool isolate_entities(EntityArray *, const char *);
+
+#endif // ISOLATE_H_
@@ -0,0 +1,212 @@
+#include "jobs.h"
+#include "log.h"
+
+static _Thread_local size_t JOB_WORKER = 0;
+
+static void deque_push(JobDeque *d, Job *job) {
+  int64_t b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+  int64_t t = atomic_load_explicit(&d->top, memory_order_acquire);
+  if (b - t >= JOB_DEQUE_CAP) PANIC_WITH(JOB_DEQUE_FULL);
+  atomic_store_explicit(&d->ring[b & (JOB_DEQUE_CAP - 1)], job,
+                        memory_order_relaxed);
+  atomic_store_explicit(&d->bottom, b + 1, memory_order_release);
+}
+
+static Job *deque_pop(JobDeque *d) {
+  int64_t b = atomic_load_explicit(&d->bottom, memory_order_relaxed) - 1;
+  atomic_store_explicit(&d->bottom, b, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+  int64_t t = atomic_load_explicit(&d->top, memory_order_relaxed);
+  if (t > b) {
+    atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+    return NULL;
+  }
+  Job *job = atomic_load_explicit(&d->ring[b & (JOB_DEQUE_CAP - 1)],
+                                  memory_order_relaxed);
+  if (t == b) {
+    // last element, race any thief for it
+    if (!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1,
+                                                 memory_order_seq_cst,
+                                                 memory_order_relaxed)) {
+      job = NULL;
+    }
+    atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+  }
+  return job;
+}
+
+static Job *deque_steal(JobDeque *d) {
+  int64_t t = atomic_load_explicit(&d->top, memory_order_acquire);
+  atomic_thread_fence(memory_order_seq_cst);
+  int64_t b = atomic_load_explicit(&d->bottom, memory_order_acquire);
+  if (t >= b) return NULL;
+  Job *job = atomic_load_explicit(&d->ring[t & (JOB_DEQUE_CAP - 1)],
+                                  memory_order_relaxed);
+  if (!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1,
+                                               memory_order_seq_cst,
+                                               memory_order_relaxed)) {
+    return NULL;
+  }
+  return job;
+}
+
+// parked threads wait for ready to move, so bump it before looking for
+// sleepers: a thread counted after that sees the new value and stays up
+static void jobs_wake(JobSystem *js) {
+  atomic_fetch_add(&js->ready, 1);
+  if (atomic_load(&js->sleepers) == 0) return;
+  pthread_mutex_lock(&js->lock);
+  pthread_cond_broadcast(&js->wake);
+  pthread_mutex_unlock(&js->lock);
+}
+
+// sleeps until ready moves past seen, read before the last failed search
+static void jobs_park(JobSystem *js, size_t seen) {
+  pthread_mutex_lock(&js->lock);
+  atomic_fetch_add(&js->sleepers, 1);
+  while (atomic_load(&js->ready) == seen && !atomic_load(&js->quit)) {
+    pthread_cond_wait(&js->wake, &js->lock);
+  }
+  atomic_fetch_sub(&js->sleepers, 1);
+  pthread_mutex_unlock(&js->lock);
+}
+
+// own deque first, then every other worker's starting with the next one
+static Job *job_find(JobSystem *js, size_t id) {
+  Job *job = deque_pop(&js->deques[id]);
+  for (size_t k = 1; job == NULL && k < js->num_workers; k++) {
+    job = deque_steal(&js->deques[(id + k) % js->num_workers]);
+  }
+  return job;
+}
+
+// true when job became runnable, the caller wakes the others once
+static bool job_release(JobSystem *js, Job *job, size_t id) {
+  if (atomic_fetch_sub(&job->unmet, 1) != 1) return false;
+  deque_push(&js->deques[id], job);
+  return true;
+}
+
+static void job_execute(JobSystem *js, Job *job, size_t id) {
+  if (job->fn) job->fn(job->arg, job->begin, job->end, id);
+  bool woke = false;
+  for (size_t s = 0; s < job->num_succ; s++) {
+    woke |= job_release(js, job->succ[s], id);
+  }
+  // the last job to finish also wakes jobs_run
+  if (atomic_fetch_sub(&js->pending, 1) == 1) woke = true;
+  if (woke) jobs_wake(js);
+}
+
+// a worker with nothing to run parks, whether or not jobs are pending:
+// the ones left are waiting on a dependency, and finishing that wakes it
+static void *job_worker(void *arg) {
+  JobWorker *w = (JobWorker *) arg;
+  JobSystem *js = w->js;
+  JOB_WORKER = w->id;
+  while (!atomic_load(&js->quit)) {
+    size_t seen = atomic_load(&js->ready);
+    Job *job = job_find(js, w->id);
+    if (job) job_execute(js, job, w->id);
+    else jobs_park(js, seen);
+  }
+  return NULL;
+}
+
+JobSystem *jobs_init(size_t num_workers) {
+  JobSystem *js = (JobSystem *) calloc(1, sizeof(JobSystem));
+  if (js == NULL) PANIC_WITH(JOB_ALLOC_FAIL);
+  js->num_workers = num_workers > 0 ? num_workers : 1;
+  js->threads = (pthread_t *) calloc(js->num_workers, sizeof(pthread_t));
+  js->workers = (JobWorker *) calloc(js->num_workers, sizeof(JobWorker));
+  js->deques  = (JobDeque *) calloc(js->num_workers, sizeof(JobDeque));
+  js->pool    = (Job *) calloc(JOB_POOL_CAP, sizeof(Job));
+  if (!js->threads || !js->workers || !js->deques || !js->pool) {
+    PANIC_WITH(JOB_ALLOC_FAIL);
+  }
+  pthread_mutex_init(&js->lock, NULL);
+  pthread_cond_init(&js->wake, NULL);
+  for (size_t w = 1; w < js->num_workers; w++) {
+    js->workers[w] = (JobWorker){ js, w };
+    if (pthread_create(&js->threads[w], NULL, job_worker, &js->workers[w]))
+      PANIC_WITH(JOB_THREAD_FAIL);
+  }
+  return js;
+}
+
+// jobs live until the end of the next jobs_run
+Job *jobs_create(JobSystem *js, job_fn *fn, void *arg, size_t begin,
+                 size_t end)
+{
+  if (js->pool_len == JOB_POOL_CAP) PANIC_WITH(JOB_POOL_FULL);
+  Job *job = &js->pool[js->pool_len++];
+  job->fn = fn;
+  job->arg = arg;
+  job->begin = begin;
+  job->end = end;
+  atomic_init(&job->unmet, 1);
+  job->num_succ = 0;
+  return job;
+}
+
+// job runs only after on has finished
+void jobs_depend(Job *job, Job *on) {
+  if (on->num_succ == JOB_MAX_SUCCESSORS) PANIC_WITH(JOB_TOO_MANY_EDGES);
+  on->succ[on->num_succ++] = job;
+  atomic_fetch_add(&job->unmet, 1);
+}
+
+// splits [0, n) into chunks of at least grain, each waiting on after when
+// given. returns a join job that finishes once every chunk has
+Job *jobs_parallel_for(JobSystem *js, Job *after, size_t n, size_t grain,
+                       job_fn *fn, void *arg)
+{
+  Job *join = jobs_create(js, NULL, NULL, 0, 0);
+  if (grain == 0) grain = 1;
+  size_t min_grain = (n + JOB_MAX_SUCCESSORS - 1) / JOB_MAX_SUCCESSORS;
+  if (grain < min_grain) grain = min_grain;
+  for (size_t begin = 0; begin < n; begin += grain) {
+    size_t end = begin + grain < n ? begin + grain : n;
+    Job *chunk = jobs_create(js, fn, arg, begin, end);
+    if (after) jobs_depend(chunk, after);
+    jobs_depend(join, chunk);
+  }
+  return join;
+}
+
+// submits the whole graph, helps run it, and returns once all of it is
+// done. the pool is recycled for the next graph
+void jobs_run(JobSystem *js) {
+  size_t id = JOB_WORKER;
+  atomic_fetch_add(&js->pending, js->pool_len);
+  for (size_t j = 0; j < js->pool_len; j++) {
+    job_release(js, &js->pool[j], id);
+  }
+  jobs_wake(js);
+  for (;;) {
+    size_t seen = atomic_load(&js->ready);
+    if (atomic_load(&js->pending) == 0) break;
+    Job *job = job_find(js, id);
+    if (job) job_execute(js, job, id);
+    else jobs_park(js, seen);
+  }
+  js->pool_len = 0;
+}
+
+void jobs_free(JobSystem *js) {
+  if (js == NULL) return;
+  pthread_mutex_lock(&js->lock);
+  atomic_store(&js->quit, true);
+  pthread_cond_broadcast(&js->wake);
+  pthread_mutex_unlock(&js->lock);
+  for (size_t w = 1; w < js->num_workers; w++) {
+    pthread_join(js->threads[w], NULL);
+  }
+  pthread_mutex_destroy(&js->lock);
+  pthread_cond_destroy(&js->wake);
+  free(js->threads);
+  free(js->workers);
+  free(js->deques);
+  free(js->pool);
+  free(js);
+}
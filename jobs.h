@@ -0,0 +1,66 @@
+#ifndef JOBS_H_
+#define JOBS_H_
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define JOB_POOL_CAP       4096 // jobs per graph
+#define JOB_DEQUE_CAP      4096 // power of two, at least JOB_POOL_CAP
+#define JOB_MAX_SUCCESSORS 64 // also caps the chunks of a parallel for
+
+// a job covers [begin, end) of whatever arg describes, plain jobs get
+// an empty range. worker is the index of the thread running it
+typedef void job_fn(void *arg, size_t begin, size_t end, size_t worker);
+
+typedef struct Job {
+  job_fn *fn;         // NULL for pure join points
+  void *arg;
+  size_t begin, end;
+  atomic_int unmet;   // unfinished dependencies, plus one until submitted
+  size_t num_succ;
+  struct Job *succ[JOB_MAX_SUCCESSORS];
+} Job;
+
+// chase-lev deque: the owner pushes and pops at the bottom, thieves
+// take from the top. only the final element is ever contended
+typedef struct {
+  _Atomic int64_t top;
+  _Atomic int64_t bottom;
+  _Atomic(Job *) ring[JOB_DEQUE_CAP];
+} JobDeque;
+
+struct JobSystem;
+
+typedef struct JobWorker {
+  struct JobSystem *js;
+  size_t id;
+} JobWorker;
+
+// fixed workers plus the calling thread as worker 0. a graph is built
+// with jobs_create/jobs_depend/jobs_parallel_for and then handed over in
+// one go by jobs_run, so no edge is ever added to a job already running
+typedef struct JobSystem {
+  size_t num_workers;
+  pthread_t *threads;
+  JobWorker *workers;
+  JobDeque *deques;
+  Job *pool;
+  size_t pool_len;
+  atomic_size_t pending;   // submitted jobs not yet finished
+  atomic_size_t ready;     // bumped when jobs become runnable or all finish
+  atomic_size_t sleepers;
+  atomic_bool quit;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+} JobSystem;
+
+JobSystem *jobs_init(size_t);
+Job *jobs_create(JobSystem *, job_fn *, void *, size_t, size_t);
+void jobs_depend(Job *, Job *);
+Job *jobs_parallel_for(JobSystem *, Job *, size_t, size_t, job_fn *, void *);
+void jobs_run(JobSystem *);
+void jobs_free(JobSystem *);
+
+#endif // JOBS_H_
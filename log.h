@@ -53,8 +53,48 @@ typedef enum {
   OCC_QUAD_BAD_CONVERSION,
   BH_ILLEGAL_BODY_ACCESS,
   BH_CHILD_NODE_DOES_NOT_EXIST,
-  MAIN_EXCEEDED_MAX_BODIES,
   HASH_INIT_FAIL,
+  HASH_ALLOC_FAIL,
+  HASH_MISSING_CELL,
+  SAP_ALLOC_FAIL,
+  NLIST_INIT_FAIL,
+  NLIST_ALLOC_FAIL,
+  CONTACT_ALLOC_FAIL,
+  ISLAND_ALLOC_FAIL,
+  ISLAND_THREAD_FAIL,
+  BVH_ALLOC_FAIL,
+  EVENT_ALLOC_FAIL,
+  VMEM_RESERVE_FAIL,
+  VMEM_COMMIT_FAIL,
+  ENTITY_RESERVE_EXHAUSTED,
+  ENTITY_ALLOC_FAIL,
+  PRIMITIVES_TOO_MANY_VERTICES,
+  PFILE_OPEN_FAIL,
+  PFILE_MAP_FAIL,
+  PFILE_BAD_HEADER,
+  PFILE_ALLOC_FAIL,
+  JOB_ALLOC_FAIL,
+  JOB_THREAD_FAIL,
+  JOB_DEQUE_FULL,
+  JOB_POOL_FULL,
+  JOB_TOO_MANY_EDGES,
+  CMDQ_ALLOC_FAIL,
+  SIM_THREAD_FAIL,
+  SIM_ALLOC_FAIL,
+  ENSEMBLE_ALLOC_FAIL,
+  DOMAIN_BAD_PROCS,
+  DOMAIN_ALLOC_FAIL,
+  DOMAIN_SOCKET_FAIL,
+  DOMAIN_FORK_FAIL,
+  DOMAIN_PEER_LOST,
+  DOMAIN_BAD_MESSAGE,
+  DOMAIN_BODIES_LOST,
+  DOMAIN_CHILD_FAIL,
+  SCENARIO_UNKNOWN,
+  SCENARIO_ALLOC_FAIL,
+  ARENA_BAD_ALIGN,
+  VMEM_DECOMMIT_FAIL,
+  PFILE_SYNC_FAIL,
 } err_t;
 
 #endif // LOG_H_
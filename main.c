@@ -8,9 +8,14 @@
 #include "primitives.h"
 #include "alloc.h"
 #include "frames.h"
-#include "physics.h"
 #include "io.h"
-#include "tree.h"
+#include "sim.h"
+#include "channel.h"
+#include "isolate.h"
+#include "domain.h"
+#include "ensemble.h"
+#include "pfile.h"
+#include "scenario.h"
 #include "colors.h"
 
 void window_err_cb(int, const char *);
@@ -18,45 +23,471 @@ void handle_key(GLFWwindow *, int, int, int, int);
 void handle_mclick(GLFWwindow *, int, int, int);
 void handle_mmove(GLFWwindow *, double, double);
 
-#define MAX_PARTICLES 2000
-size_t NUM_PS = 0;
-
-PhysicsEntity PARTICLES[MAX_PARTICLES];
-
-// 1 MB per frame
+// 512 Kb initial commit, autosized from the rebuild high water mark
 #define FRAME_MEMORY_SIZE 1024 * 512
-MemoryArena *FRAME_ARENA;
-BHNode *PTREE;
+#define JOB_WORKERS       4
+#define ISLAND_WORKERS    4
+Simulation *SIM;
 vec2 CURSOR;
 bool DRAW_QUADS = false;
 
-void ptree_rebuild(void) {
-  arena_reset(FRAME_ARENA);
-  PTREE = bhtree_init(NUM_PS, PARTICLES, FRAME_ARENA);
+typedef struct {
+  vec2 q;
+  GLfloat R;
+  GLuint color;
+} RenderInstance;
+
+// everything the render thread draws, filled by the sim thread
+typedef struct {
+  RenderInstance *inst;
+  size_t len, cap;
+  QuadBox *quads;
+  size_t num_quads, quad_cap;
+} RenderFrame;
+
+// physics runs on its own thread at SIM_HZ whatever the display does. it
+// owns every body, broadphase and toggle; the render thread only sees the
+// frames it publishes and only talks back through the command queue
+#define SIM_HZ 300
+pthread_t SIM_THREAD;
+atomic_bool SIM_QUIT;
+CommandQueue *COMMANDS;
+RenderFrame RENDER_FRAMES[TBUF_SLOTS];
+TripleBuffer SNAPSHOTS;
+
+// commands applied per step, anything past that waits for the next one
+#define CMD_BATCH 4096
+Command CMD_BUF[CMD_BATCH];
+
+// holding the left button paints bodies around the cursor
+#define BRUSH_RATE   4000.0 // spawns per second
+#define BRUSH_RADIUS 60.0
+bool BRUSH_DOWN = false;
+double BRUSH_T0;
+
+void job_render_build(void *arg, size_t begin, size_t end, size_t worker) {
+  (void) worker;
+  RenderInstance *inst = (RenderInstance *) arg;
+  Bodies *b = SIM->bodies;
+  for (size_t i = begin; i < end; i++) {
+    inst[i] = (RenderInstance){ body_q(b, i), (GLfloat) b->R[i], b->color[i] };
+  }
+}
+
+static void frame_snapshot_quads(RenderFrame *f) {
+  f->num_quads = 0;
+  if (!DRAW_QUADS) return;
+  size_t total = bhtree_snapshot_quads(SIM->ptree, f->quads, f->quad_cap);
+  if (total > f->quad_cap) {
+    f->quad_cap = total * 2;
+    f->quads = realloc(f->quads, f->quad_cap * sizeof(QuadBox));
+    if (f->quads == NULL) PANIC_WITH(JOB_ALLOC_FAIL);
+    bhtree_snapshot_quads(SIM->ptree, f->quads, f->quad_cap);
+  }
+  f->num_quads = total;
+}
+
+// next frame's tree and this frame's render instances only read bodies,
+// so the two build concurrently
+void frame_prepare(RenderFrame *f) {
+  if (f->cap < SIM->bodies->len) {
+    f->cap = SIM->bodies->len * 2;
+    f->inst = realloc(f->inst, f->cap * sizeof(RenderInstance));
+    if (f->inst == NULL) PANIC_WITH(JOB_ALLOC_FAIL);
+  }
+  f->len = SIM->bodies->len;
+  if (SIM->use_jobs) {
+    jobs_create(SIM->jobs, sim_tree_job, SIM, 0, 0);
+    jobs_parallel_for(SIM->jobs, NULL, f->len, SIM_JOB_GRAIN,
+                      job_render_build, f->inst);
+    jobs_run(SIM->jobs);
+  } else {
+    sim_rebuild_tree(SIM);
+    job_render_build(f->inst, 0, f->len, 0);
+  }
+  frame_snapshot_quads(f);
 }
 
+void render_draw(RenderFrame *f) {
+  for (size_t i = 0; i < f->len; i++) {
+    draw_circle(f->inst[i].q, f->inst[i].R, f->inst[i].color);
+  }
+  draw_quad_boxes(f->quads, f->num_quads);
+}
 
 #define SPD 400
 #define RAD 100
-void gen_n_particle_system(size_t N) {
+#define WORLD_SEED 9020
+
+Scenario world_scenario(scenario_t kind) {
+  return (Scenario){
+    .kind = kind,
+    .seed = WORLD_SEED,
+    .center = WIN_CENTER,
+    .radius = 120.0,
+    .speed = SPD,
+    .mass = RAD,
+    .clusters = 8,
+  };
+}
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return 1e3 * (double) ts.tv_sec + 1e-6 * (double) ts.tv_nsec;
+}
+
+// the initial condition in one buffer, built on the job workers if any
+PhysicsEntity *gen_world(scenario_t kind, size_t N, JobSystem *jobs) {
+  PhysicsEntity *world = (PhysicsEntity *) malloc(N * sizeof(PhysicsEntity));
+  if (world == NULL) PANIC_WITH(SCENARIO_ALLOC_FAIL);
+  Scenario sc = world_scenario(kind);
+  double t0 = now_ms();
+  scenario_generate(&sc, world, N, jobs);
+  printf("%s scenario: %zu bodies in %.2f ms\n", scenario_name(kind), N,
+         now_ms() - t0);
+  return world;
+}
+
+void gen_n_particle_system(scenario_t kind, size_t N) {
   INFO_LOG("ALLOCATING HEAP SIZE FOR PARTICLES:");
   printf("%zu Kb \n", (N * sizeof(PhysicsEntity)) / 1024);
-  for (size_t n = 0; n < N; n++) {
-    PARTICLES[n] = new_physics_entity(
-      (vec2){(double)get_random(0, WIN_W), (double)get_random(0, WIN_H)},
-      (vec2){(double)get_random(-SPD, SPD), (double)get_random(-SPD, SPD)},
-      (vec2){0.0f, 0.0f},
-      (double)get_random(RAD, RAD),
-      get_random_color_from_palette()
-    );
-    physics_entity_bind_geometry(&PARTICLES[n], GEOM_CIRCLE, (Geometry){
-        .circ.R = 0.08 * PARTICLES[n].m
-    });
-  }
-  NUM_PS = N;
-}
-
-int main(void) {
+  PhysicsEntity *world = gen_world(kind, N, SIM->jobs);
+  for (size_t n = 0; n < N; n++) sim_spawn(SIM, world[n]);
+  free(world);
+}
+
+// ./run --domains P [bodies] [steps] [scenario]: headless, one process
+// per slab
+int run_domains(int argc, char **argv) {
+  size_t procs  = argc > 2 ? strtoul(argv[2], NULL, 10) : 4;
+  size_t bodies = argc > 3 ? strtoul(argv[3], NULL, 10) : 700;
+  size_t steps  = argc > 4 ? strtoul(argv[4], NULL, 10) : 600;
+  scenario_t kind = argc > 5 ? scenario_from_name(argv[5]) : SCENARIO_UNIFORM;
+  printf("%zu domains, %zu bodies, %zu steps\n", procs, bodies, steps);
+
+  // every rank is handed the same world and keeps its own slab of it.
+  // the workers are gone again before the fork
+  JobSystem *jobs = jobs_init(JOB_WORKERS);
+  PhysicsEntity *world = gen_world(kind, bodies, jobs);
+  jobs_free(jobs);
+
+  Domain *d = dom_launch(procs);
+  dom_populate(d, world, bodies);
+  free(world);
+  dom_report(d);
+  for (size_t k = 0; k < steps; k++) {
+    dom_step(d, PHYSICS_DT);
+    if ((k + 1) % 300 == 0) dom_report(d);  // once a simulated second
+  }
+  if (steps % 300 != 0) dom_report(d);
+  dom_finish(d);
+  return EXIT_SUCCESS;
+}
+
+// members step whole on one worker each, so they get no threads of
+// their own and only ever hold their own bodies
+static SimConfig member_config(size_t bodies) {
+  return (SimConfig){
+    .max_bodies = bodies,
+    .initial_bodies = bodies,
+    .arena_bytes = 1 << 16,
+    .arena_strat = PAGE_VIRTUALLY,
+    .job_workers = 0,
+    .island_workers = 1,
+  };
+}
+
+// member k is the scenario under seed WORLD_SEED + k
+static void member_fill(Simulation *s, scenario_t kind, size_t bodies,
+                        size_t k, PhysicsEntity *buf)
+{
+  Scenario sc = world_scenario(kind);
+  sc.seed += k;
+  scenario_generate(&sc, buf, bodies, NULL);
+  for (size_t n = 0; n < bodies; n++) sim_spawn(s, buf[n]);
+  sim_reindex(s);
+}
+
+// bit for bit on the state that is integrated
+static bool member_match(Simulation *a, Simulation *b) {
+  Bodies *p = a->bodies, *q = b->bodies;
+  size_t bytes = p->len * sizeof(double);
+  return p->len == q->len
+      && memcmp(p->x,  q->x,  bytes) == 0 && memcmp(p->y,  q->y,  bytes) == 0
+      && memcmp(p->vx, q->vx, bytes) == 0 && memcmp(p->vy, q->vy, bytes) == 0
+      && memcmp(p->m,  q->m,  bytes) == 0;
+}
+
+// ./run --ensemble N [steps] [bodies] [scenario]: headless, N small sims
+// stepped on the pool, then each again on its own and compared
+int run_ensemble(int argc, char **argv) {
+  size_t sims   = argc > 2 ? strtoul(argv[2], NULL, 10) : 64;
+  size_t steps  = argc > 3 ? strtoul(argv[3], NULL, 10) : 300;
+  size_t bodies = argc > 4 ? strtoul(argv[4], NULL, 10) : 200;
+  scenario_t kind = argc > 5 ? scenario_from_name(argv[5]) : SCENARIO_UNIFORM;
+  printf("%zu sims, %zu bodies, %zu steps\n", sims, bodies, steps);
+
+  PhysicsEntity *buf = (PhysicsEntity *) malloc(bodies * sizeof(*buf));
+  if (buf == NULL) PANIC_WITH(SCENARIO_ALLOC_FAIL);
+  Ensemble *e = ensemble_init(JOB_WORKERS);
+  for (size_t k = 0; k < sims; k++) {
+    member_fill(ensemble_add(e, member_config(bodies)), kind, bodies, k, buf);
+  }
+  double t0 = now_ms();
+  ensemble_run(e, steps, PHYSICS_DT);
+  double pool_ms = now_ms() - t0;
+
+  double serial_ms = 0.0;
+  size_t matched = 0;
+  for (size_t k = 0; k < sims; k++) {
+    Simulation *s = sim_init(member_config(bodies));
+    member_fill(s, kind, bodies, k, buf);
+    t0 = now_ms();
+    sim_advance(s, steps, PHYSICS_DT);
+    serial_ms += now_ms() - t0;
+    if (member_match(s, e->sims[k])) matched++;
+    sim_free(s);
+  }
+  ensemble_free(e);
+  free(buf);
+
+  printf("pool %.2f ms, serial %.2f ms, %zu of %zu sims match\n",
+         pool_ms, serial_ms, matched, sims);
+  return matched == sims ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+typedef struct {
+  double m, x, y;
+} PFileSums;
+
+static void pfile_sums(ParticleFile *pf, PFileBlock *b, void *arg) {
+  (void) pf;
+  PFileSums *sums = (PFileSums *) arg;
+  for (size_t i = 0; i < b->len; i++) {
+    sums->m += b->m[i];
+    sums->x += b->x[i];
+    sums->y += b->y[i];
+  }
+}
+
+static bool sums_close(double a, double b) {
+  return fabs(a - b) <= 1e-9 * fmax(fabs(a), fabs(b));
+}
+
+// ./run --pfile PATH [bodies] [steps] [scenario]: offline, the bodies live
+// in PATH and only a block of them is in memory at a time. the file is
+// written, stepped and put in z-order, which must keep every body
+int run_pfile(int argc, char **argv) {
+  if (argc < 3) PANIC_WITH(PFILE_OPEN_FAIL);
+  const char *path = argv[2];
+  size_t bodies = argc > 3 ? strtoul(argv[3], NULL, 10) : 1 << 20;
+  size_t steps  = argc > 4 ? strtoul(argv[4], NULL, 10) : 60;
+  scenario_t kind = argc > 5 ? scenario_from_name(argv[5]) : SCENARIO_UNIFORM;
+  printf("%s: %zu bodies, %zu steps\n", path, bodies, steps);
+
+  ParticleFile *pf = pfile_create(path, bodies, (vec2){ 0.0, 0.0 },
+                                  (vec2){ WIN_W, WIN_H });
+  PhysicsEntity *buf = (PhysicsEntity *) malloc(PFILE_BLOCK * sizeof(*buf));
+  if (buf == NULL) PANIC_WITH(SCENARIO_ALLOC_FAIL);
+  Scenario sc = world_scenario(kind);
+  double t0 = now_ms();
+  for (size_t first = 0; first < bodies; first += PFILE_BLOCK) {
+    size_t len = bodies - first < PFILE_BLOCK ? bodies - first : PFILE_BLOCK;
+    scenario_generate_range(&sc, buf, first, len, NULL);
+    pfile_write(pf, first, buf, len);
+  }
+  free(buf);
+  printf("written in %.2f ms\n", now_ms() - t0);
+
+  t0 = now_ms();
+  for (size_t k = 0; k < steps; k++) {
+    pfile_integrate(pf, VERLET_POS | VERLET_VEL, PHYSICS_DT);
+  }
+  printf("stepped in %.2f ms\n", now_ms() - t0);
+
+  PFileSums before = { 0 }, after = { 0 };
+  pfile_stream(pf, pfile_sums, &before);
+  t0 = now_ms();
+  pfile_sort_morton(pf);
+  printf("z-ordered in %.2f ms\n", now_ms() - t0);
+  pfile_stream(pf, pfile_sums, &after);
+  bool kept = pf->hdr->len == bodies && sums_close(before.m, after.m)
+           && sums_close(before.x, after.x) && sums_close(before.y, after.y);
+  pfile_close(pf);
+  printf("%s\n", kept ? "every body kept" : "bodies lost in the sort");
+  return kept ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// input as the sim thread applies it, between two steps
+void app_key(int key) {
+  switch (key) {
+  case GLFW_KEY_C:
+    sim_clear(SIM);
+    break;
+  case GLFW_KEY_Q:
+    DRAW_QUADS = !DRAW_QUADS;
+    break;
+  case GLFW_KEY_B:
+    sim_set_broadphase(SIM, (SIM->broadphase + 1) % BROADPHASE_TOTAL);
+    break;
+  case GLFW_KEY_S:
+    SIM->use_contact_solver = !SIM->use_contact_solver;
+    break;
+  case GLFW_KEY_I:
+    SIM->use_islands = !SIM->use_islands;
+    break;
+  case GLFW_KEY_T:
+    SIM->use_ccd = !SIM->use_ccd;
+    break;
+  case GLFW_KEY_Z:
+    SIM->use_sleep = !SIM->use_sleep;
+    for (size_t n = 0; n < SIM->bodies->len; n++) {
+      physics_wake(SIM->bodies, n);
+      SIM->bodies->idle[n] = 0.0;
+    }
+    break;
+  case GLFW_KEY_E:
+    SIM->use_events = !SIM->use_events;
+    if (SIM->use_events) events_reset(SIM->events, SIM->bodies);
+    break;
+  case GLFW_KEY_J:
+    SIM->use_jobs = !SIM->use_jobs && SIM->jobs;
+    break;
+  case GLFW_KEY_M:
+    arena_report(SIM->arena, "frame arena");
+    arena_report(SIM->events->arena, "event arena");
+    break;
+  default:
+    break;
+  }
+}
+
+void app_spawn(vec2 q) {
+  sim_spawn(SIM, new_physics_entity(
+    q,
+    (vec2){(double)get_random(-SPD, SPD), (double)get_random(-SPD, SPD)},
+    (vec2){0.0f, 0.0f},
+    (double)get_random(100, 100),
+    get_random_color_from_palette()
+  ));
+}
+
+// spawns in a batch are indexed together
+void app_spawn_flush(size_t first) {
+  sim_index_from(SIM, first);
+}
+
+// a key may clear or wake bodies, so spawns queued ahead of it are
+// indexed before it runs
+void app_commands(void) {
+  size_t n = cmdq_pop_batch(COMMANDS, CMD_BUF, CMD_BATCH);
+  size_t first = SIM->bodies->len;
+  for (size_t c = 0; c < n; c++) {
+    switch (CMD_BUF[c].type) {
+    case CMD_SPAWN:
+      app_spawn(CMD_BUF[c].q);
+      break;
+    case CMD_KEY:
+      app_spawn_flush(first);
+      app_key(CMD_BUF[c].key);
+      first = SIM->bodies->len;
+      break;
+    }
+  }
+  app_spawn_flush(first);
+}
+
+void app_tick(void) {
+  app_commands();
+  if (SIM->ptree_stale) sim_rebuild_tree(SIM);
+  BEGIN_PHYSICS(&SIM->clock, dt, 1);
+    sim_step(SIM, dt);
+  END_PHYSICS();
+  sim_settle(SIM);
+  frame_prepare((RenderFrame *) tbuf_back(&SNAPSHOTS));
+  tbuf_publish(&SNAPSHOTS);
+}
+
+// fixed rate ticks, a tick that overruns pushes the schedule back rather
+// than bursting to catch up, BEGIN_PHYSICS accumulates the lost time
+void *sim_thread(void *arg) {
+  (void) arg;
+  const double period = 1.0 / SIM_HZ;
+  double next = glfwGetTime();
+  while (!atomic_load(&SIM_QUIT)) {
+    app_tick();
+    next += period;
+    double now = glfwGetTime();
+    if (next > now) FRAME_SLEEP(next - now);
+    else next = now;
+  }
+  return NULL;
+}
+
+#ifdef ISOLATE
+// memory is locked before the sim thread exists, it is the one that
+// grows it. mlockall covers the stacks and heap as well, the arenas and
+// the body store are locked on their own too so they stay locked when
+// mlockall is refused and arena_report can say so either way
+void isolate_memory(void) {
+  isolate_process();
+  isolate_arena(SIM->arena, "frame arena");
+  isolate_arena(SIM->events->arena, "event arena");
+  isolate_entities(SIM->entities, "body store");
+}
+
+// the workers are pinned before the body store is faulted in, so the
+// pages land near the workers that step them, see sim_prefault
+void isolate_workers(void) {
+  isolate_thread(pthread_self(), "render thread", ISOLATE_RENDER_CORE,
+                 ISOLATE_FIFO_PRIO);
+  for (size_t w = 1; w < SIM->jobs->num_workers; w++) {
+    isolate_thread(SIM->jobs->threads[w], "job worker",
+                   ISOLATE_WORKER_CORE + (int) w - 1, ISOLATE_FIFO_PRIO);
+  }
+  for (size_t w = 1; w < SIM->islands->num_workers; w++) {
+    isolate_thread(SIM->islands->threads[w], "island worker",
+                   ISOLATE_WORKER_CORE + (int) w - 1, ISOLATE_FIFO_PRIO);
+  }
+}
+
+void isolate_sim_thread(void) {
+  isolate_thread(SIM_THREAD, "sim thread", ISOLATE_SIM_CORE,
+                 ISOLATE_FIFO_PRIO);
+}
+#endif
+
+// golden angle steps spread the strokes like sunflower seeds, no point
+// repeats so a brush held still never stacks two bodies on one spot
+void brush_paint(void) {
+  static size_t k = 1;  // k = 0 would land on the click itself
+  double now = glfwGetTime();
+  size_t n = (size_t) ((now - BRUSH_T0) * BRUSH_RATE);
+  BRUSH_T0 += (double) n / BRUSH_RATE;
+  for (size_t s = 0; s < n; s++, k++) {
+    double r = BRUSH_RADIUS * sqrt(fmod((double) k * 0.6180339887, 1.0));
+    double a = (double) k * 2.3999632297;
+    vec2 q = { CURSOR.x + r * cos(a), CURSOR.y + r * sin(a) };
+    if (q.x <= 0.0 || q.x >= WIN_W || q.y <= 0.0 || q.y >= WIN_H) continue;
+    if (!cmdq_push(COMMANDS, (Command){ CMD_SPAWN, 0, q })) break;
+  }
+}
+
+int main(int argc, char **argv) {
+  if (argc > 1 && strcmp(argv[1], "--domains") == 0) {
+    return run_domains(argc, argv);
+  }
+  if (argc > 1 && strcmp(argv[1], "--ensemble") == 0) {
+    return run_ensemble(argc, argv);
+  }
+  if (argc > 1 && strcmp(argv[1], "--pfile") == 0) {
+    return run_pfile(argc, argv);
+  }
+  // ./run [--scenario NAME [bodies]]
+  bool scene = argc > 2 && strcmp(argv[1], "--scenario") == 0;
+  scenario_t kind = scene ? scenario_from_name(argv[2]) : SCENARIO_UNIFORM;
+  size_t bodies = scene && argc > 3 ? strtoul(argv[3], NULL, 10) : 700;
   HW_INIT();
   WINS_INIT(window_err_cb);
 
@@ -71,44 +502,62 @@ int main(void) {
   ENABLE_PRIMITIVES();
   FRAME_TARGET_FPS(300);
 
-  SEED_RANDOM(9020);
+  SEED_RANDOM(WORLD_SEED);
 
-  FRAME_ARENA = arena_init(FRAME_MEMORY_SIZE, PAGE_PHYSICALLY);
-  gen_n_particle_system(700);
+  SIM = sim_init((SimConfig){
+    .max_bodies = ENTITY_RESERVE_BODIES,
+    .initial_bodies = bodies,
+    .arena_bytes = FRAME_MEMORY_SIZE,
+    .arena_strat = PAGE_PHYSICALLY | PAGE_HUGE | PAGE_PARALLEL,
+    .job_workers = JOB_WORKERS,
+    .island_workers = ISLAND_WORKERS,
+  });
+#ifdef ISOLATE
+  isolate_workers();
+#endif
+  sim_prefault(SIM, bodies);
+  gen_n_particle_system(kind, bodies);
+  sim_reindex(SIM);
 
-  SpatialHash *sp_hash = init_spatial_hash(100);
-  for (int P = 0; P < NUM_PS; P++) {
-    add_entity_to_spatial_hash(sp_hash, &PARTICLES[P]);
+  COMMANDS = cmdq_init();
+  tbuf_init(&SNAPSHOTS, &RENDER_FRAMES[0], &RENDER_FRAMES[1],
+            &RENDER_FRAMES[2]);
+#ifdef ISOLATE
+  isolate_memory();
+#endif
+  if (pthread_create(&SIM_THREAD, NULL, sim_thread, NULL)) {
+    PANIC_WITH(SIM_THREAD_FAIL);
   }
+#ifdef ISOLATE
+  isolate_sim_thread();
+#endif
 
   while (!glfwWindowShouldClose(win)) {
     BEGIN_FRAME();
-      ptree_rebuild();
-      BEGIN_PHYSICS(dt, 1);
-        bhtree_integrate(VERLET_POS, PTREE, dt);
-        bhtree_apply_boundaries(PTREE);
-        bhtree_apply_collisions(PTREE);
-        bhtree_apply_singular_gravity(PTREE, WIN_CENTER);
-        bhtree_integrate(VERLET_VEL, PTREE, dt);
-        bhtree_clear_forces(PTREE);
-      END_PHYSICS();
-
       glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
       OPEN_SHADER(shd);
-        bhtree_draw(PTREE);
-        if (DRAW_QUADS) bhtree_draw_quads(PTREE, 0xFFFFFFFF);
+        render_draw((RenderFrame *) tbuf_front(&SNAPSHOTS));
       CLOSE_SHADER();
 
       glfwSwapBuffers(win);
       glfwPollEvents();
+      if (BRUSH_DOWN) brush_paint();
     END_FRAME();
   }
 
-  arena_reset(FRAME_ARENA);
-  arena_free(FRAME_ARENA);
+  atomic_store(&SIM_QUIT, true);
+  pthread_join(SIM_THREAD, NULL);
+  cmdq_free(COMMANDS);
+  for (size_t f = 0; f < TBUF_SLOTS; f++) {
+    free(RENDER_FRAMES[f].inst);
+    free(RENDER_FRAMES[f].quads);
+  }
+
+  sim_free(SIM);
   HW_TEARDOWN();
   glfwTerminate();
+  TRACE_REPORT();
   SUCCESS_LOG("program can exit successfully, good bye");
   exit(EXIT_SUCCESS);
 }
@@ -120,38 +569,27 @@ void window_err_cb(int error, const char *desc) {
 
 void handle_key(GLFWwindow *win, int key, int scode, int act, int mods) {
   (void) scode; (void) mods;
-  if (key == GLFW_KEY_ESCAPE && act == GLFW_PRESS) {
+  if (act != GLFW_PRESS) return;
+  if (key == GLFW_KEY_ESCAPE) {
     glfwSetWindowShouldClose(win, GLFW_TRUE);
-  }
-  if (key == GLFW_KEY_C && act == GLFW_PRESS) {
-    for (size_t n = 0; n < NUM_PS; n++) memset(PARTICLES, 0, sizeof(PARTICLES));
-    NUM_PS = 0;
-    PTREE = NULL;
-  }
-  if (key == GLFW_KEY_Q && act == GLFW_PRESS) {
-    DRAW_QUADS = !DRAW_QUADS;
+  } else if (!cmdq_push(COMMANDS, (Command){ CMD_KEY, key, {0.0, 0.0} })) {
+    INFO_LOG("command queue full, key dropped");
   }
 }
 
+// a click spawns at the cursor, holding the button keeps painting
 void handle_mclick(GLFWwindow *win, int button, int act, int mods) {
   (void) mods;
-  if (button == GLFW_MOUSE_BUTTON_LEFT && act == GLFW_PRESS) {
+  if (button != GLFW_MOUSE_BUTTON_LEFT) return;
+  BRUSH_DOWN = act == GLFW_PRESS;
+  if (BRUSH_DOWN) {
     double x, y;
     glfwGetCursorPos(win, &x, &y);
-    printf("Generating particle @ (%f, %f)\n", x, y);
-    if (NUM_PS == MAX_PARTICLES) PANIC_WITH(MAIN_EXCEEDED_MAX_BODIES);
-    PARTICLES[NUM_PS] = new_physics_entity(
-      (vec2){x, WIN_H - y},
-      (vec2){(double)get_random(-SPD, SPD), (double)get_random(-SPD, SPD)},
-      (vec2){0.0f, 0.0f},
-      (double)get_random(100, 100),
-      get_random_color_from_palette()
-    );
-    physics_entity_bind_geometry(&PARTICLES[NUM_PS], GEOM_CIRCLE, (Geometry){
-        .circ.R = 0.08 * PARTICLES[NUM_PS].m
-    });
-    NUM_PS++;
-    printf("NUMBER OF PARTICLES: %zu\n", NUM_PS);
+    CURSOR = (vec2){ x, WIN_H - y };
+    BRUSH_T0 = glfwGetTime();
+    if (!cmdq_push(COMMANDS, (Command){ CMD_SPAWN, 0, CURSOR })) {
+      INFO_LOG("command queue full, click dropped");
+    }
   }
 }
 
@@ -1,21 +1,84 @@
 #include "nerd.h"
 #include "colors.h"
 
-GLint get_random(int low, int high) {return (rand() % (high - low + 1)) + low;}
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+
+void philox4x32(uint32_t c[4], const uint32_t key[2]) {
+  uint32_t k0 = key[0], k1 = key[1];
+  for (int round = 0; round < 10; round++) {
+    uint64_t p0 = (uint64_t) PHILOX_M0 * c[0];
+    uint64_t p1 = (uint64_t) PHILOX_M1 * c[2];
+    uint32_t c1 = c[1], c3 = c[3];
+    c[0] = (uint32_t) (p1 >> 32) ^ c1 ^ k0;
+    c[1] = (uint32_t) p1;
+    c[2] = (uint32_t) (p0 >> 32) ^ c3 ^ k1;
+    c[3] = (uint32_t) p0;
+    k0 += PHILOX_W0;
+    k1 += PHILOX_W1;
+  }
+}
+
+RandStream rand_stream(uint64_t seed, uint64_t stream) {
+  return (RandStream){
+    .key = { (uint32_t) seed, (uint32_t) (seed >> 32) },
+    .stream = stream,
+  };
+}
+
+uint32_t rand_u32(RandStream *rs) {
+  if (rs->left == 0) {
+    rs->buf[0] = (uint32_t) rs->ctr;
+    rs->buf[1] = (uint32_t) (rs->ctr >> 32);
+    rs->buf[2] = (uint32_t) rs->stream;
+    rs->buf[3] = (uint32_t) (rs->stream >> 32);
+    philox4x32(rs->buf, rs->key);
+    rs->ctr++;
+    rs->left = 4;
+  }
+  return rs->buf[--rs->left];
+}
+
+// [0, 1) in steps of 2^-32, one word per draw
+double rand_unit(RandStream *rs) { return (double) rand_u32(rs) * 0x1.0p-32; }
+
+// [low, high] without the modulo bias, lemire's multiply and reject
+int rand_range(RandStream *rs, int low, int high) {
+  uint32_t range = (uint32_t) ((int64_t) high - low) + 1u;
+  if (range == 0) return (int) rand_u32(rs);
+  uint64_t m = (uint64_t) rand_u32(rs) * range;
+  if ((uint32_t) m < range) {
+    uint32_t floor = -range % range;
+    while ((uint32_t) m < floor) m = (uint64_t) rand_u32(rs) * range;
+  }
+  return (int) ((int64_t) low + (int64_t) (m >> 32));
+}
+
+// the stream behind get_random, for the main and sim threads only
+static RandStream RANDOM = { .key = { 1u, 0u } };
+
+void rand_seed(uint64_t seed) { RANDOM = rand_stream(seed, 0); }
+
+GLint get_random(int low, int high) { return rand_range(&RANDOM, low, high); }
 
 GLuint get_random_color(void) {
   return ((GLuint)get_random(0, 255) << 24)
        | ((GLuint)get_random(0, 255) << 16)
        | ((GLuint)get_random(0, 255) << 8)
-       | 0xFF; 
+       | 0xFF;
 }
 
+static const GLuint color_palette[] = {
+  CLR_RED    , CLR_GREEN  , CLR_BLUE   , CLR_YELLOW , CLR_MAGENTA, CLR_CYAN  ,
+  CLR_ORANGE , CLR_PURPLE , CLR_FGREEN , CLR_NBLUE  , CLR_GRAY   , CLR_BROWN ,
+  CLR_LGREEN , CLR_SBLUE  , CLR_PINK   , CLR_AQUA   ,
+};
+#define PALETTE_LEN (sizeof(color_palette) / sizeof(color_palette[0]))
+
+GLuint palette_color(uint32_t i) { return color_palette[i % PALETTE_LEN]; }
+
 GLuint get_random_color_from_palette(void) {
-  static const GLuint color_palette[] = {
-    CLR_RED    , CLR_GREEN  , CLR_BLUE   , CLR_YELLOW , CLR_MAGENTA, CLR_CYAN  ,
-    CLR_ORANGE , CLR_PURPLE , CLR_FGREEN , CLR_NBLUE  , CLR_GRAY   , CLR_BROWN ,
-    CLR_LGREEN , CLR_SBLUE  , CLR_PINK   , CLR_AQUA   ,
-  };
-  return color_palette[get_random(0, sizeof(color_palette) /
-                                     sizeof(color_palette[0]) - 1)];
+  return color_palette[get_random(0, PALETTE_LEN - 1)];
 }
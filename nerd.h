@@ -2,6 +2,7 @@
 #define NERD_H_
 #include <GL/glew.h>
 #include <math.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <time.h>
 
@@ -61,7 +62,24 @@ static inline double vec2area(vec2 diag) { return diag.x * diag.y; }
 
 #define WIN_CENTER ((vec2){WIN_W * 0.5f, WIN_H * 0.5f})
 
-#define SEED_RANDOM(N) do { srand(N); } while(0)
+// philox4x32-10, counter based: the numbers of stream s are a pure
+// function of (seed, s, n), so any thread can produce any of them
+typedef struct {
+  uint32_t key[2];
+  uint64_t stream;
+  uint64_t ctr;       // blocks drawn so far
+  uint32_t buf[4];
+  unsigned left;      // unread words of buf
+} RandStream;
+
+void philox4x32(uint32_t ctr[4], const uint32_t key[2]);
+RandStream rand_stream(uint64_t seed, uint64_t stream);
+uint32_t rand_u32(RandStream *);
+double rand_unit(RandStream *);
+int rand_range(RandStream *, int, int);
+
+void rand_seed(uint64_t);
+#define SEED_RANDOM(N) do { rand_seed(N); } while(0)
 
 #define BYTE_TO_BINARY_PATTERN "%c%c%c%c%c%c%c%c"
 #define BYTE_TO_BINARY(byte)  \
@@ -76,6 +94,7 @@ static inline double vec2area(vec2 diag) { return diag.x * diag.y; }
 
 GLint get_random(int, int);
 GLuint get_random_color(void);
+GLuint palette_color(uint32_t);
 GLuint get_random_color_from_palette(void);
 
 #endif // NERD_H_
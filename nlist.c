@@ -0,0 +1,96 @@
+#include "nlist.h"
+#include "log.h"
+
+NeighborList *nlist_init(double skin, Bodies *bodies) {
+  if (skin <= 0) PANIC_WITH(NLIST_INIT_FAIL);
+  NeighborList *nl = (NeighborList *) calloc(1, sizeof(NeighborList));
+  if (nl == NULL) PANIC_WITH(NLIST_INIT_FAIL);
+  nl->skin  = skin;
+  nl->stale = true;
+  nl->sap   = sap_init(bodies);
+  return nl;
+}
+
+void nlist_add(NeighborList *nl, uint32_t body) {
+  if (nl->num_bodies == nl->body_cap) {
+    nl->body_cap = nl->body_cap ? 2 * nl->body_cap : 256;
+    nl->q_ref = realloc(nl->q_ref, nl->body_cap * sizeof(vec2));
+    if (nl->q_ref == NULL) PANIC_WITH(NLIST_ALLOC_FAIL);
+  }
+  nl->num_bodies++;
+  sap_add(nl->sap, body);
+  nl->stale = true;
+}
+
+static void pair_append(Bodies *bodies, uint32_t a, uint32_t b, void *ctx) {
+  (void) bodies;
+  NeighborList *nl = (NeighborList *) ctx;
+  if (nl->len == nl->cap) {
+    nl->cap = nl->cap ? 2 * nl->cap : 1024;
+    nl->pairs = realloc(nl->pairs, nl->cap * sizeof(NeighborPair));
+    if (nl->pairs == NULL) PANIC_WITH(NLIST_ALLOC_FAIL);
+  }
+  nl->pairs[nl->len++] = (NeighborPair){ a, b };
+}
+
+static bool nlist_drifted(NeighborList *nl) {
+  const double limit2 = 0.25 * nl->skin * nl->skin;
+  for (size_t n = 0; n < nl->num_bodies; n++) {
+    vec2 dq = vec2sub(body_q(nl->sap->bodies, n), nl->q_ref[n]);
+    if (vec2dot(dq, dq) > limit2) return true;
+  }
+  return false;
+}
+
+static void nlist_rebuild(NeighborList *nl) {
+  nl->len = 0;
+  sap_update(nl->sap);
+  sap_for_each_pair(nl->sap, 0.5 * nl->skin, pair_append, nl);
+  for (size_t n = 0; n < nl->num_bodies; n++) {
+    nl->q_ref[n] = body_q(nl->sap->bodies, n);
+  }
+  nl->stale = false;
+  nl->rebuilds++;
+}
+
+bool nlist_update(NeighborList *nl) {
+  if (!nl->stale && !nlist_drifted(nl)) return false;
+  nlist_rebuild(nl);
+  return true;
+}
+
+// the pairs point at bodies that moved, they are swept again next update
+void nlist_compact(NeighborList *nl, const uint32_t *to, size_t len) {
+  for (size_t k = len; k < nl->num_bodies; k++) {
+    if (to[k] != BODY_REMOVED) nl->q_ref[to[k]] = nl->q_ref[k];
+  }
+  sap_compact(nl->sap, to, len);
+  nl->num_bodies = len;
+  nl->len = 0;
+  nl->stale = true;
+}
+
+void nlist_clear(NeighborList *nl) {
+  sap_clear(nl->sap);
+  nl->num_bodies = 0;
+  nl->len = 0;
+  nl->stale = true;
+}
+
+void nlist_free(NeighborList *nl) {
+  if (nl == NULL) return;
+  sap_free(nl->sap);
+  free(nl->pairs);
+  free(nl->q_ref);
+  free(nl);
+}
+
+void nlist_for_each_pair(NeighborList *nl, pair_fn fn, void *ctx) {
+  for (size_t n = 0; n < nl->len; n++) {
+    fn(nl->sap->bodies, nl->pairs[n].a, nl->pairs[n].b, ctx);
+  }
+}
+
+void nlist_apply_collisions(NeighborList *nl) {
+  nlist_for_each_pair(nl, pair_impulsive_collision, NULL);
+}
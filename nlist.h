@@ -0,0 +1,34 @@
+#ifndef NLIST_H_
+#define NLIST_H_
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "physics.h"
+#include "sap.h"
+
+typedef struct { uint32_t a, b; } NeighborPair;
+
+// pairs within skin of touching, reused until any body has drifted
+// more than skin / 2 from where it was when the list was built
+typedef struct {
+  double skin;
+  bool stale;
+  size_t rebuilds;
+  size_t len, cap;
+  NeighborPair *pairs;
+  size_t num_bodies, body_cap;
+  vec2 *q_ref;
+  SweepAndPrune *sap;
+} NeighborList;
+
+NeighborList *nlist_init(double, Bodies *);
+void nlist_add(NeighborList *, uint32_t);
+bool nlist_update(NeighborList *);
+void nlist_compact(NeighborList *, const uint32_t *, size_t);
+void nlist_clear(NeighborList *);
+void nlist_free(NeighborList *);
+
+void nlist_for_each_pair(NeighborList *, pair_fn, void *);
+void nlist_apply_collisions(NeighborList *);
+
+#endif // NLIST_H_
@@ -0,0 +1,301 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "pfile.h"
+#include "log.h"
+
+#define PFILE_BLOCK_BYTES (PFILE_BLOCK * PFILE_FIELDS * sizeof(double))
+
+static uint8_t *block_base(ParticleFile *pf, size_t b) {
+  return pf->map + PFILE_HEADER + b * PFILE_BLOCK_BYTES;
+}
+
+static void pfile_map(ParticleFile *pf, PFileHeader hdr) {
+  pf->blocks = (hdr.len + PFILE_BLOCK - 1) / PFILE_BLOCK;
+  pf->map_bytes = PFILE_HEADER + pf->blocks * PFILE_BLOCK_BYTES;
+  if (ftruncate(pf->fd, (off_t) pf->map_bytes) != 0) {
+    PANIC_WITH(PFILE_OPEN_FAIL);
+  }
+  void *map = mmap(NULL, pf->map_bytes, PROT_READ | PROT_WRITE, MAP_SHARED,
+                   pf->fd, 0);
+  if (map == MAP_FAILED) PANIC_WITH(PFILE_MAP_FAIL);
+  pf->map = (uint8_t *) map;
+  pf->hdr = (PFileHeader *) map;
+  *pf->hdr = hdr;
+}
+
+static ParticleFile *pfile_alloc(const char *path, int flags) {
+  ParticleFile *pf = (ParticleFile *) calloc(1, sizeof(ParticleFile));
+  if (pf == NULL) PANIC_WITH(PFILE_ALLOC_FAIL);
+  if (strlen(path) >= sizeof(pf->path)) PANIC_WITH(PFILE_OPEN_FAIL);
+  strcpy(pf->path, path);
+  pf->fd = open(path, flags, 0644);
+  if (pf->fd < 0) PANIC_WITH(PFILE_OPEN_FAIL);
+  return pf;
+}
+
+// the file is sparse until written, creating a huge store is instant
+ParticleFile *pfile_create(const char *path, size_t n, vec2 min, vec2 max) {
+  ParticleFile *pf = pfile_alloc(path, O_RDWR | O_CREAT | O_TRUNC);
+  pfile_map(pf, (PFileHeader){
+    PFILE_MAGIC, n, PFILE_BLOCK, min.x, min.y, max.x, max.y,
+  });
+  return pf;
+}
+
+ParticleFile *pfile_open(const char *path) {
+  ParticleFile *pf = pfile_alloc(path, O_RDWR);
+  PFileHeader hdr;
+  ssize_t got = pread(pf->fd, &hdr, sizeof(PFileHeader), 0);
+  if (got != (ssize_t) sizeof(PFileHeader) || hdr.magic != PFILE_MAGIC
+      || hdr.block != PFILE_BLOCK) {
+    PANIC_WITH(PFILE_BAD_HEADER);
+  }
+  pfile_map(pf, hdr);
+  return pf;
+}
+
+void pfile_close(ParticleFile *pf) {
+  if (pf == NULL) return;
+  munmap(pf->map, pf->map_bytes);
+  close(pf->fd);
+  free(pf);
+}
+
+PFileBlock pfile_block(ParticleFile *pf, size_t b) {
+  double *f = (double *) block_base(pf, b);
+  size_t first = b * PFILE_BLOCK;
+  size_t len = pf->hdr->len - first;
+  return (PFileBlock){
+    .first = first,
+    .len = len < PFILE_BLOCK ? len : PFILE_BLOCK,
+    .x  = f + 0 * PFILE_BLOCK, .y  = f + 1 * PFILE_BLOCK,
+    .vx = f + 2 * PFILE_BLOCK, .vy = f + 3 * PFILE_BLOCK,
+    .ax = f + 4 * PFILE_BLOCK, .ay = f + 5 * PFILE_BLOCK,
+    .m  = f + 6 * PFILE_BLOCK, .R  = f + 7 * PFILE_BLOCK,
+  };
+}
+
+void pfile_write(ParticleFile *pf, size_t first, PhysicsEntity *src,
+                 size_t n)
+{
+  for (size_t i = 0; i < n; i++) {
+    size_t at = first + i;
+    PFileBlock b = pfile_block(pf, at / PFILE_BLOCK);
+    size_t k = at % PFILE_BLOCK;
+    b.x[k]  = src[i].q.x;       b.y[k]  = src[i].q.y;
+    b.vx[k] = src[i].dq_dt.x;   b.vy[k] = src[i].dq_dt.y;
+    b.ax[k] = src[i].d2q_dt2.x; b.ay[k] = src[i].d2q_dt2.y;
+    b.m[k]  = src[i].m;         b.R[k]  = src[i].geom.circ.R;
+  }
+}
+
+// only the state the file stores is copied, everything else is untouched
+void pfile_read(ParticleFile *pf, size_t first, PhysicsEntity *dst, size_t n)
+{
+  for (size_t i = 0; i < n; i++) {
+    size_t at = first + i;
+    PFileBlock b = pfile_block(pf, at / PFILE_BLOCK);
+    size_t k = at % PFILE_BLOCK;
+    dst[i].q       = (vec2){ b.x[k],  b.y[k]  };
+    dst[i].dq_dt   = (vec2){ b.vx[k], b.vy[k] };
+    dst[i].d2q_dt2 = (vec2){ b.ax[k], b.ay[k] };
+    dst[i].m = b.m[k];
+    dst[i].geom.circ.R = b.R[k];
+  }
+}
+
+// one pass front to back. the next block is prefetched while the current
+// one is worked on and dropped from the mapping once done, so resident
+// memory stays at a couple of blocks and every block is paged once
+void pfile_stream(ParticleFile *pf, pfile_block_fn *fn, void *ctx) {
+  madvise(block_base(pf, 0), pf->blocks * PFILE_BLOCK_BYTES,
+          MADV_SEQUENTIAL);
+  for (size_t b = 0; b < pf->blocks; b++) {
+    if (b + 1 < pf->blocks) {
+      madvise(block_base(pf, b + 1), PFILE_BLOCK_BYTES, MADV_WILLNEED);
+    }
+    PFileBlock blk = pfile_block(pf, b);
+    fn(pf, &blk, ctx);
+    // dirty pages stay in the page cache for writeback, nothing is lost
+    madvise(block_base(pf, b), PFILE_BLOCK_BYTES, MADV_DONTNEED);
+  }
+}
+
+typedef struct {
+  integration_flag flag;
+  double dt;
+} IntegrateCtx;
+
+static inline void reflect(double *q, double *v, double R, double lo,
+                           double hi)
+{
+  if (*q - R <= lo) {
+    *v *= -1;
+    *q = lo + R;
+  } else if (*q + R >= hi) {
+    *v *= -1;
+    *q = hi - R;
+  }
+}
+
+static void integrate_block(ParticleFile *pf, PFileBlock *b, void *arg) {
+  IntegrateCtx *ctx = (IntegrateCtx *) arg;
+  double *restrict x  = b->x,  *restrict y  = b->y;
+  double *restrict vx = b->vx, *restrict vy = b->vy;
+  const double *restrict ax = b->ax, *restrict ay = b->ay;
+  const double dt = ctx->dt, h = 0.5 * dt * dt;
+  const size_t n = b->len;
+  if (ctx->flag & VERLET_POS) {
+    for (size_t i = 0; i < n; i++) {
+      x[i] += vx[i] * dt + ax[i] * h;
+      y[i] += vy[i] * dt + ay[i] * h;
+    }
+    PFileHeader *hdr = pf->hdr;
+    for (size_t i = 0; i < n; i++) {
+      reflect(&x[i], &vx[i], b->R[i], hdr->min_x, hdr->max_x);
+      reflect(&y[i], &vy[i], b->R[i], hdr->min_y, hdr->max_y);
+    }
+  }
+  if (ctx->flag & VERLET_VEL) {
+    for (size_t i = 0; i < n; i++) {
+      vx[i] += 0.5 * ax[i] * dt;
+      vy[i] += 0.5 * ay[i] * dt;
+    }
+  }
+}
+
+// positions are reflected off the header's box as part of VERLET_POS
+void pfile_integrate(ParticleFile *pf, integration_flag flag, double dt) {
+  IntegrateCtx ctx = { flag, dt };
+  pfile_stream(pf, integrate_block, &ctx);
+}
+
+static uint32_t morton_spread(uint32_t v) {
+  v &= 0xFFFF;
+  v = (v | (v << 8)) & 0x00FF00FF;
+  v = (v | (v << 4)) & 0x0F0F0F0F;
+  v = (v | (v << 2)) & 0x33333333;
+  v = (v | (v << 1)) & 0x55555555;
+  return v;
+}
+
+static uint32_t morton_quantize(double q, double lo, double hi) {
+  double t = (q - lo) / (hi - lo);
+  if (t < 0.0) t = 0.0;
+  if (t > 1.0) t = 1.0;
+  return (uint32_t) (t * 65535.0);
+}
+
+typedef struct {
+  uint64_t *keys;  // morton key << 32 | body index
+} MortonCtx;
+
+static void morton_block(ParticleFile *pf, PFileBlock *b, void *arg) {
+  MortonCtx *ctx = (MortonCtx *) arg;
+  PFileHeader *hdr = pf->hdr;
+  for (size_t i = 0; i < b->len; i++) {
+    uint32_t mx = morton_quantize(b->x[i], hdr->min_x, hdr->max_x);
+    uint32_t my = morton_quantize(b->y[i], hdr->min_y, hdr->max_y);
+    uint64_t key = morton_spread(mx) | (morton_spread(my) << 1);
+    ctx->keys[b->first + i] = (key << 32) | (b->first + i);
+  }
+}
+
+static int key_cmp(const void *a, const void *b) {
+  uint64_t ka = *(const uint64_t *) a, kb = *(const uint64_t *) b;
+  return (ka > kb) - (ka < kb);
+}
+
+typedef struct {
+  ParticleFile *out;
+  uint32_t *dest;     // final index of every body, by its index now
+  uint32_t *slot_to;  // final offset in its block, by order of arrival
+  size_t *fill;       // arrivals so far, by block of the new file
+  double *scratch;    // one field of one block
+} ScatterCtx;
+
+// source blocks come in front to back and every body is appended to the
+// bucket of the block it ends up in. the bucket is that block of the new
+// file, so each of its field arrays is written front to back as well
+static void scatter_block(ParticleFile *pf, PFileBlock *b, void *arg) {
+  (void) pf;
+  ScatterCtx *ctx = (ScatterCtx *) arg;
+  for (size_t s = 0; s < b->len; s++) {
+    size_t p = ctx->dest[b->first + s];
+    PFileBlock dst = pfile_block(ctx->out, p / PFILE_BLOCK);
+    size_t k = ctx->fill[p / PFILE_BLOCK]++;
+    ctx->slot_to[dst.first + k] = (uint32_t) (p % PFILE_BLOCK);
+    dst.x[k]  = b->x[s];  dst.y[k]  = b->y[s];
+    dst.vx[k] = b->vx[s]; dst.vy[k] = b->vy[s];
+    dst.ax[k] = b->ax[s]; dst.ay[k] = b->ay[s];
+    dst.m[k]  = b->m[s];  dst.R[k]  = b->R[s];
+  }
+}
+
+// a bucket holds the right bodies in the order they arrived, this puts
+// them in key order one field at a time
+static void settle_block(ParticleFile *pf, PFileBlock *b, void *arg) {
+  (void) pf;
+  ScatterCtx *ctx = (ScatterCtx *) arg;
+  const uint32_t *to = ctx->slot_to + b->first;
+  for (size_t f = 0; f < PFILE_FIELDS; f++) {
+    double *field = b->x + f * PFILE_BLOCK;
+    memcpy(ctx->scratch, field, b->len * sizeof(double));
+    for (size_t k = 0; k < b->len; k++) field[to[k]] = ctx->scratch[k];
+  }
+}
+
+// rewrites the file in z-order so bodies that are close in space share a
+// block. after the keys are sorted both files are only ever streamed: the
+// old one once to scatter into buckets, the new one once to order them.
+// the new file is on disk before it replaces the old
+void pfile_sort_morton(ParticleFile *pf) {
+  size_t n = pf->hdr->len;
+  if (n > UINT32_MAX) PANIC_WITH(PFILE_ALLOC_FAIL);
+  MortonCtx keys = { (uint64_t *) malloc(n * sizeof(uint64_t)) };
+  if (keys.keys == NULL && n > 0) PANIC_WITH(PFILE_ALLOC_FAIL);
+  pfile_stream(pf, morton_block, &keys);
+  if (n > 1) qsort(keys.keys, n, sizeof(uint64_t), key_cmp);
+
+  char tmp[sizeof(pf->path) + sizeof(".morton")];
+  snprintf(tmp, sizeof(tmp), "%s.morton", pf->path);
+  PFileHeader *hdr = pf->hdr;
+  ScatterCtx ctx = {
+    .out = pfile_create(tmp, n, (vec2){ hdr->min_x, hdr->min_y },
+                        (vec2){ hdr->max_x, hdr->max_y }),
+    .dest = (uint32_t *) malloc(n * sizeof(uint32_t)),
+    .slot_to = (uint32_t *) malloc(n * sizeof(uint32_t)),
+    .fill = (size_t *) calloc(pf->blocks + 1, sizeof(size_t)),
+    .scratch = (double *) malloc(PFILE_BLOCK * sizeof(double)),
+  };
+  if ((n > 0 && (ctx.dest == NULL || ctx.slot_to == NULL))
+      || ctx.fill == NULL || ctx.scratch == NULL) {
+    PANIC_WITH(PFILE_ALLOC_FAIL);
+  }
+  for (size_t p = 0; p < n; p++) {
+    ctx.dest[keys.keys[p] & UINT32_MAX] = (uint32_t) p;
+  }
+  free(keys.keys);
+
+  pfile_stream(pf, scatter_block, &ctx);
+  pfile_stream(ctx.out, settle_block, &ctx);
+  free(ctx.dest);
+  free(ctx.slot_to);
+  free(ctx.fill);
+  free(ctx.scratch);
+
+  ParticleFile *out = ctx.out;
+  if (msync(out->map, out->map_bytes, MS_SYNC) != 0) {
+    PANIC_WITH(PFILE_SYNC_FAIL);
+  }
+  if (rename(tmp, pf->path) != 0) PANIC_WITH(PFILE_OPEN_FAIL);
+  munmap(pf->map, pf->map_bytes);
+  close(pf->fd);
+  memcpy(out->path, pf->path, sizeof(pf->path));
+  *pf = *out;
+  free(out);
+}
@@ -0,0 +1,57 @@
+#ifndef PFILE_H_
+#define PFILE_H_
+#include <stddef.h>
+#include <stdint.h>
+
+#include "physics.h"
+#include "tree.h"
+
+#define PFILE_MAGIC   0x454C494650524747ull // "GGRPFILE"
+#define PFILE_HEADER  4096
+#define PFILE_BLOCK   65536  // bodies per block, every field array is paged
+#define PFILE_FIELDS  8
+
+// the file is a header page followed by fixed size blocks. each block
+// holds PFILE_BLOCK bodies as one array per field, so a block is a small
+// structure of arrays that can be paged in, streamed and paged out alone
+typedef struct {
+  uint64_t magic;
+  uint64_t len;
+  uint64_t block;
+  double min_x, min_y, max_x, max_y; // box the boundaries reflect off
+} PFileHeader;
+
+typedef struct {
+  size_t first;  // index of body 0 of this block
+  size_t len;
+  double *x, *y;
+  double *vx, *vy;
+  double *ax, *ay;
+  double *m;
+  double *R;
+} PFileBlock;
+
+typedef struct {
+  int fd;
+  PFileHeader *hdr;
+  uint8_t *map;
+  size_t map_bytes;
+  size_t blocks;
+  char path[256];
+} ParticleFile;
+
+typedef void pfile_block_fn(ParticleFile *, PFileBlock *, void *);
+
+ParticleFile *pfile_create(const char *path, size_t n, vec2 min, vec2 max);
+ParticleFile *pfile_open(const char *path);
+void pfile_close(ParticleFile *);
+
+PFileBlock pfile_block(ParticleFile *, size_t);
+void pfile_write(ParticleFile *, size_t, PhysicsEntity *, size_t);
+void pfile_read(ParticleFile *, size_t, PhysicsEntity *, size_t);
+
+void pfile_stream(ParticleFile *, pfile_block_fn *, void *);
+void pfile_integrate(ParticleFile *, integration_flag, double);
+void pfile_sort_morton(ParticleFile *);
+
+#endif // PFILE_H_
@@ -1,3 +1,5 @@
+#include <stdatomic.h>
+
 #include "config.h"
 #include "physics.h"
 #include "log.h"
@@ -6,7 +8,7 @@ PhysicsEntity
 new_physics_entity(vec2 q0, vec2 dq0_dt, vec2 d2q0_dt2, double m, GLuint clr) {
   return (PhysicsEntity){ q0, dq0_dt, d2q0_dt2, m, clr, GEOM_NONE, {
       .none = NULL,
-  }};
+  }, BODY_AWAKE, 0.0, SLEEP_TIME };
 }
 
 void
@@ -16,90 +18,170 @@ physics_entity_bind_geometry(PhysicsEntity *entity, geometry_t type, Geometry g)
   entity->geom   = g;
 }
 
-#define SINGULARITY_PADDING 100
-void force_singular_gravity(PhysicsEntity *p, vec2 Rsink) {
-  static double effectiveM = 10;
-  vec2 rvec   = vec2sub(p->q, Rsink);
+bool physics_captured_by_sink(Bodies *b, size_t i, vec2 Rsink) {
+  vec2 rvec = vec2sub(body_q(b, i), Rsink);
+  return vec2dot(rvec, rvec) < SINGULARITY_PADDING;
+}
+
+void physics_verlet_pos(Bodies *b, size_t i, double dt) {
+  b->x[i] += b->vx[i] * dt + 0.5 * b->ax[i] * dt * dt;
+  b->y[i] += b->vy[i] * dt + 0.5 * b->ay[i] * dt * dt;
+}
+
+void physics_verlet_vel(Bodies *b, size_t i, double dt) {
+  b->vx[i] += 0.5 * b->ax[i] * dt;
+  b->vy[i] += 0.5 * b->ay[i] * dt;
+}
+
+void physics_apply_boundaries(Bodies *b, size_t i) {
+  double R = b->R[i];
+  if (b->x[i] - R <= 0.0) {
+    b->vx[i] *= -1;
+    b->x[i] = R;
+  } else if (b->x[i] + R >= WIN_W) {
+    b->vx[i] *= -1;
+    b->x[i] = WIN_W - R;
+  }
+  if (b->y[i] - R <= 0.0) {
+    b->vy[i] *= -1;
+    b->y[i] = R;
+  } else if (b->y[i] + R >= WIN_H) {
+    b->vy[i] *= -1;
+    b->y[i] = WIN_H - R;
+  }
+}
+
+void force_singular_gravity(Bodies *b, size_t i, Sink *sink) {
+  vec2 rvec   = vec2sub(body_q(b, i), sink->q);
   vec2 rhat   = vec2scale(1 / vec2mag(rvec), rvec);
   double r2   = vec2dot(rvec, rvec);
   if (r2 < SINGULARITY_PADDING) {
-    p->dq_dt = (vec2){0,0};
-    p->d2q_dt2 = (vec2){0,0};
-    effectiveM += p->m;
+    b->vx[i] = 0; b->vy[i] = 0;
+    b->ax[i] = 0; b->ay[i] = 0;
+    double M = atomic_load(&sink->M);
+    while (!atomic_compare_exchange_weak(&sink->M, &M, M + b->m[i])) {}
     return;
   }
-  vec2 F      = vec2scale((-1) * effectiveM * (1.0f / r2), rhat);
-  p->d2q_dt2  = vec2add(p->d2q_dt2, F);
+  vec2 F      = vec2scale((-1) * atomic_load(&sink->M) * (1.0f / r2), rhat);
+  b->ax[i]   += F.x;
+  b->ay[i]   += F.y;
 }
 
-void force_pairwise_gravity(PhysicsEntity *pi, PhysicsEntity *pj) {
-  vec2 rvec   = vec2sub(pj->q, pi->q);
+void force_pairwise_gravity(Bodies *b, size_t i, size_t j) {
+  vec2 rvec   = vec2sub(body_q(b, j), body_q(b, i));
   double r2   = vec2dot(rvec, rvec);
-  vec2 F_ij   = vec2scale(pi->m * pj->m * (1.0f / r2), rvec);
-  pi->d2q_dt2 = vec2add(pi->d2q_dt2, vec2scale(1.0f / pi->m, F_ij));
-  pj->d2q_dt2 = vec2add(pj->d2q_dt2, vec2scale(-1.0f / pj->m, F_ij));
+  vec2 F_ij   = vec2scale(b->m[i] * b->m[j] * (1.0f / r2), rvec);
+  vec2 a_i    = vec2scale(1.0f / b->m[i], F_ij);
+  vec2 a_j    = vec2scale(-1.0f / b->m[j], F_ij);
+  b->ax[i] += a_i.x; b->ay[i] += a_i.y;
+  b->ax[j] += a_j.x; b->ay[j] += a_j.y;
+}
+
+void physics_collide_velocities(Bodies *b, size_t c1, size_t c2,
+                                vec2 n, double e)
+{
+  double v_rel = vec2dot(vec2sub(body_v(b, c2), body_v(b, c1)), n);
+  if (v_rel < 0.0f) {
+    physics_wake(b, c1);
+    physics_wake(b, c2);
+    double j = (1.0f + e) * v_rel / (1.0f / b->m[c1] + 1.0f / b->m[c2]);
+    vec2 impulse = vec2scale(j, n);
+    body_set_v(b, c1, vec2add(body_v(b, c1),
+                              vec2scale(1.0f / b->m[c1], impulse)));
+    body_set_v(b, c2, vec2sub(body_v(b, c2),
+                              vec2scale(1.0f / b->m[c2], impulse)));
+  }
 }
 
-static void _resolve_impulse_collision(PhysicsEntity *c1,
-                                        PhysicsEntity *c2,
+static void _resolve_impulse_collision(Bodies *b, size_t c1, size_t c2,
                                         vec2 diff,
                                         double overlap,
                                         double e // coefficient of restitution
                                         )
 {
   vec2 n = vec2norm(diff);
-  vec2 v1 = c1->dq_dt;
-  vec2 v2 = c2->dq_dt;
-
-  double v_rel = vec2dot(vec2sub(v2, v1), n);
-  if (v_rel < 0.0f) {
-    double j = (1.0f + e) * v_rel / (1.0f / c1->m + 1.0f / c2->m);
-    vec2 impulse = vec2scale(j, n);
-    c1->dq_dt = vec2add(c1->dq_dt, vec2scale(1.0f / c1->m, impulse));
-    c2->dq_dt = vec2sub(c2->dq_dt, vec2scale(1.0f / c2->m, impulse));
-  }
+  physics_collide_velocities(b, c1, c2, n, e);
 
-  double corr = overlap / (c1->m + c2->m);
-  c1->q = vec2add(c1->q, vec2scale(-corr * c1->m, n));
-  c2->q = vec2add(c2->q, vec2scale(corr * c2->m, n));
+  double corr = overlap / (b->m[c1] + b->m[c2]);
+  body_set_q(b, c1, vec2add(body_q(b, c1), vec2scale(-corr * b->m[c1], n)));
+  body_set_q(b, c2, vec2add(body_q(b, c2), vec2scale(corr * b->m[c2], n)));
 }
 
-void force_pairwise_impulsive_collision(PhysicsEntity *pi, PhysicsEntity *pj) {
-  vec2 diff = vec2sub(pj->q, pi->q);
-  double overlap = (pi->geom.circ.R + pi->geom.circ.R) - vec2mag(diff);
+void force_pairwise_impulsive_collision(Bodies *b, size_t i, size_t j) {
+  vec2 diff = vec2sub(body_q(b, j), body_q(b, i));
+  double overlap = (b->R[i] + b->R[j]) - vec2mag(diff);
   if (overlap <= 0.0f) return;
-  _resolve_impulse_collision(pi, pj, diff, overlap, 0.33f);
+  physics_touch(b, i);
+  physics_touch(b, j);
+  if (physics_is_asleep(b, i) && physics_is_asleep(b, j)) return;
+  physics_wake(b, i);
+  physics_wake(b, j);
+  _resolve_impulse_collision(b, i, j, diff, overlap, RESTITUTION);
+}
+
+void pair_impulsive_collision(Bodies *b, uint32_t i, uint32_t j, void *ctx) {
+  (void) ctx;
+  force_pairwise_impulsive_collision(b, i, j);
 }
 
-SpatialHash* init_spatial_hash(int sector_size) {  
-  if (sector_size <= 0) PANIC_WITH(HASH_INIT_FAIL);
-     
-  SpatialHash *hash_table = (SpatialHash*) malloc(sizeof(SpatialHash));
-  if (hash_table == NULL) PANIC_WITH(HASH_INIT_FAIL);
- 
-  hash_table->sector_size = sector_size;
-  hash_table->num_entries = 0;
-  hash_table->table_size = 101;  
+// a slow body only counts as resting while something holds it: it
+// touched another body within SLEEP_TIME, or no force acts on it at all.
+// otherwise a slow body in free flight would stop dead in mid air.
+// reads the acceleration of the step, call it before clearing forces
+void physics_update_sleep(Bodies *b, size_t i, double dt) {
+  double a2 = b->ax[i] * b->ax[i] + b->ay[i] * b->ay[i];
+  bool held = b->contact[i] < SLEEP_TIME || a2 < SLEEP_ACCEL * SLEEP_ACCEL;
+  b->contact[i] += dt;
+  if (b->state[i] == BODY_SLEEPING) {
+    if (!held) physics_wake(b, i);
+    return;
+  }
+  double v2 = b->vx[i] * b->vx[i] + b->vy[i] * b->vy[i];
+  if (!held || v2 > SLEEP_SPEED * SLEEP_SPEED) {
+    b->idle[i] = 0.0;
+    return;
+  }
+  b->idle[i] += dt;
+  if (b->idle[i] < SLEEP_TIME) return;
+  b->state[i] = BODY_SLEEPING;
+  b->vx[i] = 0; b->vy[i] = 0;
+}
 
-  hash_table->buckets
-    = (Bucket **) calloc(hash_table->table_size, sizeof(PhysicsEntity*));
-  if (hash_table->buckets == NULL) PANIC_WITH(HASH_INIT_FAIL);
+bool physics_is_fast(Bodies *b, size_t i, double dt) {
+  return vec2mag(body_v(b, i)) * dt > CCD_FAST_RATIO * b->R[i];
+}
 
-  return hash_table;
-} 
+// earliest t in [0, dt] at which two linearly moving circles first touch
+double toi_swept_circles(Bodies *b, size_t i, size_t j, double dt) {
+  vec2 d = vec2sub(body_q(b, j), body_q(b, i));
+  vec2 w = vec2sub(body_v(b, j), body_v(b, i));
+  double R = b->R[i] + b->R[j];
+  double a = vec2dot(w, w);
+  double b2 = 2.0f * vec2dot(d, w);
+  double c = vec2dot(d, d) - R * R;
+  if (c <= 0.0f || b2 >= 0.0f || a <= 0.0f) return TOI_NONE;
+  double disc = b2 * b2 - 4.0f * a * c;
+  if (disc < 0.0f) return TOI_NONE;
+  double t = (-b2 - sqrt(disc)) / (2.0f * a);
+  return (t >= 0.0f && t <= dt) ? t : TOI_NONE;
+}
 
-void add_entity_to_spatial_hash(SpatialHash *hash_table, PhysicsEntity *entity) {
-    int sector_x = (int)(entity->q.x / hash_table->sector_size);
-    int sector_y = (int)(entity->q.y / hash_table->sector_size);
+static double toi_axis(double q, double v, double R, double hi) {
+  if (v < 0.0f) return (R - q) / v;
+  if (v > 0.0f) return (hi - R - q) / v;
+  return TOI_NONE;
+}
 
-    int index = hash_func(sector_x, sector_y, hash_table->table_size);
-    
-    Bucket *list_head   = hash_table->buckets[index];
-    Bucket *new_bucket  = malloc(sizeof(Bucket));
-    new_bucket->element = entity;
-    new_bucket->next    = list_head;
-    hash_table->buckets[index] = new_bucket;
-    hash_table->num_entries++;
+// first wall of the [0, WIN_W] x [0, WIN_H] box hit within dt
+double toi_wall(Bodies *b, size_t i, double dt, vec2 *normal) {
+  double R  = b->R[i];
+  double tx = toi_axis(b->x[i], b->vx[i], R, WIN_W);
+  double ty = toi_axis(b->y[i], b->vy[i], R, WIN_H);
+  bool hit_x = tx >= 0.0f && tx <= dt;
+  bool hit_y = ty >= 0.0f && ty <= dt;
+  if (hit_x && (!hit_y || tx <= ty)) { *normal = X_HAT; return tx; }
+  if (hit_y) { *normal = Y_HAT; return ty; }
+  return TOI_NONE;
 }
 
 #if 0 // DEPRECATED
@@ -2,12 +2,28 @@
 #define PHYSICS_H_
 #include <GL/glew.h>
 #include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include "nerd.h"
 
+#define RESTITUTION 0.33f
+#define SINGULARITY_PADDING 100  // squared capture radius of the sink
+
+#define CCD_FAST_RATIO 0.5  // bodies crossing this much of R per step
+#define CCD_MAX_EVENTS 4    // impacts resolved per fast body per step
+#define TOI_NONE -1.0
+
+#define SLEEP_SPEED 4.0  // below this speed a body counts as resting
+#define SLEEP_TIME  0.5  // seconds at rest before it is put to sleep
+#define SLEEP_ACCEL 1e-9 // below this nothing is pulling on a body
+
 typedef enum { BOUNDARY_INF_BOX, BOUNDARY_TOROID } boundary_t;
 
 typedef enum { GEOM_NONE, GEOM_CIRCLE } geometry_t;
 
+typedef enum { BODY_AWAKE, BODY_SLEEPING } body_state_t;
+
 typedef union {
   void *none;
   struct { double R; } circ;
@@ -19,55 +35,102 @@ typedef struct PhysicsEntity {
   GLuint color;
   geometry_t geom_t;
   Geometry geom;
+  body_state_t state;
+  double idle;     // seconds spent below SLEEP_SPEED
+  double contact;  // seconds since it last touched another body
 } PhysicsEntity;
 
+// the live bodies, one array per field, body i is index i of each. the
+// hot fields are what every per-body pass reads, the cold ones are only
+// wanted by collisions, sleep and drawing. entities.h owns the memory
+typedef struct {
+  double *x, *y;
+  double *vx, *vy;
+  double *ax, *ay;
+  double *m;
+  double *R;            // cold from here on, every body is a circle
+  GLuint *color;
+  body_state_t *state;
+  double *idle;         // seconds spent below SLEEP_SPEED
+  double *contact;      // seconds since it last touched another body
+  size_t len;
+} Bodies;
+
+static inline vec2 body_q(const Bodies *b, size_t i) {
+  return (vec2){ b->x[i], b->y[i] };
+}
+
+static inline vec2 body_v(const Bodies *b, size_t i) {
+  return (vec2){ b->vx[i], b->vy[i] };
+}
+
+static inline void body_set_q(Bodies *b, size_t i, vec2 q) {
+  b->x[i] = q.x; b->y[i] = q.y;
+}
+
+static inline void body_set_v(Bodies *b, size_t i, vec2 v) {
+  b->vx[i] = v.x; b->vy[i] = v.y;
+}
+
+// a point mass that swallows whatever gets too close, and grows by it.
+// atomic since jobs apply it to disjoint body ranges concurrently
+typedef struct {
+  vec2 q;
+  _Atomic double M;
+} Sink;
+
 typedef void (*force_fn)(PhysicsEntity *, PhysicsEntity *);
 typedef void (*force_sink)(PhysicsEntity *, double, vec2);
+typedef void (*pair_fn)(Bodies *, uint32_t, uint32_t, void *);
+
+// in a compaction map, see entities_compact
+#define BODY_REMOVED UINT32_MAX
+
+void physics_verlet_pos(Bodies *, size_t, double);
+void physics_verlet_vel(Bodies *, size_t, double);
+void physics_apply_boundaries(Bodies *, size_t);
+void force_singular_gravity(Bodies *, size_t, Sink *);
+bool physics_captured_by_sink(Bodies *, size_t, vec2);
+void force_pairwise_gravity(Bodies *, size_t, size_t);
+void force_pairwise_impulsive_collision(Bodies *, size_t, size_t);
+void pair_impulsive_collision(Bodies *, uint32_t, uint32_t, void *);
+void physics_collide_velocities(Bodies *, size_t, size_t, vec2, double);
+
+static inline bool physics_is_asleep(Bodies *b, size_t i) {
+  return b->state[i] == BODY_SLEEPING;
+}
+// idle is kept, so a sleeper nudged by a resting neighbour dozes off again
+// on the next update; only real motion resets the timer
+static inline void physics_wake(Bodies *b, size_t i) {
+  b->state[i] = BODY_AWAKE;
+}
+static inline void physics_touch(Bodies *b, size_t i) { b->contact[i] = 0.0; }
+void physics_update_sleep(Bodies *, size_t, double);
 
-void force_singular_gravity(PhysicsEntity *, vec2);
-void force_pairwise_gravity(PhysicsEntity *, PhysicsEntity *);
-void force_pairwise_impulsive_collision(PhysicsEntity *, PhysicsEntity *);
+bool physics_is_fast(Bodies *, size_t, double);
+double toi_swept_circles(Bodies *, size_t, size_t, double);
+double toi_wall(Bodies *, size_t, double, vec2 *);
 
 PhysicsEntity new_physics_entity(vec2, vec2, vec2, double, GLuint);
 void physics_entity_bind_geometry(PhysicsEntity *, geometry_t, Geometry);
 
-#define BEGIN_PHYSICS(DT, COUNT)                \
-  static double __t0 = 0.0f;                    \
-  static double __acc = 0.0f;                   \
-  static const double __dt = 1.0f / 300.0f;     \
-  static const double DT = __dt / COUNT;        \
+#define PHYSICS_DT (1.0f / 300.0f)
+
+// wall time owed to the fixed step, one per simulation
+typedef struct { double t0, acc; } PhysicsClock;
+
+#define BEGIN_PHYSICS(CLOCK, DT, COUNT)         \
+  const double DT = PHYSICS_DT / COUNT;         \
   double __t1 = glfwGetTime();                  \
-  __acc += __t1 - __t0;                         \
-  __t0 = __t1;                                  \
-  while (__acc >= __dt) {                       \
+  (CLOCK)->acc += __t1 - (CLOCK)->t0;           \
+  (CLOCK)->t0 = __t1;                           \
+  while ((CLOCK)->acc >= PHYSICS_DT) {          \
     int __step_count = COUNT;                   \
-    __acc -= __dt;                              \
+    (CLOCK)->acc -= PHYSICS_DT;                 \
   while(__step_count > 0) {
 #define END_PHYSICS()                           \
   __step_count--; }}
 
-typedef struct Bucket {
-  int num;
-  void *element;
-  struct Bucket *next;
-} Bucket;
-
-typedef struct SpatialHash {
-    int table_size;
-    int sector_size;
-    int num_entries;
-    Bucket **buckets;
-} SpatialHash;
-
-SpatialHash *init_spatial_hash(int sector_size);
-void add_entity_to_spatial_hash(SpatialHash *hash_table, PhysicsEntity *entity);
-
-static inline int hash_func(int x, int y, int table_size) {
-    int hash = x + y * 104729;  // large prime
-    return (abs(hash) % table_size);
-}
-
-
 #endif // PHYSICS_H_
 
 #if 0 // deprecated
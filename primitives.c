@@ -13,11 +13,11 @@ typedef enum {
 
 static bool PRIMITIVES_ENABLED = false;
 static GLuint VBO = 0, VAO = 0;
+static size_t STREAM_HEAD = 0; // next free vertex in VBO
 
-static void BUFFER_CLEAR(void) {
-  if (VAO != 0) { glDeleteVertexArrays(1, &VAO); VAO = 0; }
-  if (VBO != 0) { glDeleteVertexArrays(1, &VBO); VBO = 0; }
-}
+// every shape fits, the largest is a 100 segment circle fan
+#define PRIMITIVES_MAX_VERTICES    128
+#define PRIMITIVES_STREAM_VERTICES (1 << 16)
 
 static void BUFFER_DEFINE_VERTEX_ATTRIBUTES(attr_flag attrs) {
   if (attrs & ATTR_POS) {
@@ -42,6 +42,29 @@ static void BUFFER_UNBIND(void) {
   glBindVertexArray(0);
 }
 
+// draws append to VBO instead of overwriting what an earlier draw may
+// still be reading. when the stream is full the storage is orphaned, the
+// driver hands out fresh memory and frees the old once the gpu is done.
+// returns the first vertex of the upload
+static GLint BUFFER_UPLOAD(const struct vertex *vertices, size_t bytes) {
+  if (bytes > PRIMITIVES_MAX_VERTICES * sizeof(struct vertex)) {
+    PANIC_WITH(PRIMITIVES_TOO_MANY_VERTICES);
+  }
+  size_t count = bytes / sizeof(struct vertex);
+  if (STREAM_HEAD + count > PRIMITIVES_STREAM_VERTICES) {
+    glBufferData(GL_ARRAY_BUFFER,
+                 PRIMITIVES_STREAM_VERTICES * sizeof(struct vertex),
+                 NULL, GL_STREAM_DRAW);
+    STREAM_HEAD = 0;
+  }
+  GLint first = (GLint) STREAM_HEAD;
+  glBufferSubData(GL_ARRAY_BUFFER,
+                  (GLintptr) (STREAM_HEAD * sizeof(struct vertex)),
+                  (GLsizeiptr) bytes, vertices);
+  STREAM_HEAD += count;
+  return first;
+}
+
 static void BUFFER_DRAW(GLenum prim, GLint fst, GLsizei lst) {
   glBindVertexArray(VAO);
   glDrawArrays(prim, fst, lst);
@@ -54,6 +77,11 @@ void ENABLE_PRIMITIVES(void) {
   glGenBuffers(1, &VBO);
   HW_REGISTER(ID_GL_VAO_PTR, &VAO);
   HW_REGISTER(ID_GL_VBO_PTR, &VBO);
+  BUFFER_BIND();
+    glBufferData(GL_ARRAY_BUFFER,
+                 PRIMITIVES_STREAM_VERTICES * sizeof(struct vertex),
+                 NULL, GL_STREAM_DRAW);
+  BUFFER_UNBIND();
   PRIMITIVES_ENABLED = true;
   INFO_LOG("primitive drawable shapes enabled");
 }
@@ -65,7 +93,6 @@ void draw_eqtriangle(vec2 pos,
                      GLuint color_hex2,
                      GLuint color_hex3)
 {
-  BUFFER_CLEAR();
   struct vertex vertices[] = {
     {{-size, -size, 0.0f}, COLOR_NORM(color_hex1)},
     {{size, -size, 0.0f},  COLOR_NORM(color_hex2)},
@@ -74,7 +101,7 @@ void draw_eqtriangle(vec2 pos,
 
   BUFFER_BIND();
     BUFFER_DEFINE_VERTEX_ATTRIBUTES(ATTR_POS | ATTR_CLR);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+    GLint first = BUFFER_UPLOAD(vertices, sizeof(vertices));
   BUFFER_UNBIND();
 
   mat4 model = ID_MAT4;
@@ -91,7 +118,7 @@ void draw_eqtriangle(vec2 pos,
   GLint model_uni_loc = glGetUniformLocation(SHADER(), "model");
   glUniformMatrix4fv(model_uni_loc, 1, GL_FALSE, (GLfloat*) model);
 
-  BUFFER_DRAW(GL_TRIANGLES, 0, 3);
+  BUFFER_DRAW(GL_TRIANGLES, first, 3);
 }
 
 void draw_circle(vec2 pos, GLfloat radius, GLuint color_hex) {
@@ -112,8 +139,7 @@ void draw_circle(vec2 pos, GLfloat radius, GLuint color_hex) {
 
   BUFFER_BIND();
     BUFFER_DEFINE_VERTEX_ATTRIBUTES(ATTR_POS | ATTR_CLR);
-    glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)sizeof(vertices),
-                 vertices, GL_STATIC_DRAW);
+    GLint first = BUFFER_UPLOAD(vertices, sizeof(vertices));
   BUFFER_UNBIND();
 
   mat4 model = ID_MAT4;
@@ -125,12 +151,11 @@ void draw_circle(vec2 pos, GLfloat radius, GLuint color_hex) {
   GLint model_uni_loc = glGetUniformLocation(SHADER(), "model");
   glUniformMatrix4fv(model_uni_loc, 1, GL_FALSE, (GLfloat*) model);
 
-  BUFFER_DRAW(GL_TRIANGLE_FAN, 0, num_segments + 2);
+  BUFFER_DRAW(GL_TRIANGLE_FAN, first, num_segments + 2);
 }
 
 void draw_circle_boundary(vec2 pos, GLfloat radius, GLuint color_hex) {
   const int num_segments = 100;
-  BUFFER_CLEAR();
   struct vertex vertices[num_segments];
   float color[] = COLOR_NORM(color_hex);
   for (int i = 0; i < num_segments; i++) {
@@ -146,8 +171,7 @@ void draw_circle_boundary(vec2 pos, GLfloat radius, GLuint color_hex) {
 
   BUFFER_BIND();
     BUFFER_DEFINE_VERTEX_ATTRIBUTES(ATTR_POS | ATTR_CLR);
-    glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)sizeof(vertices),
-                vertices, GL_STATIC_DRAW);
+    GLint first = BUFFER_UPLOAD(vertices, sizeof(vertices));
   BUFFER_UNBIND();
 
   mat4 model = ID_MAT4;
@@ -159,7 +183,7 @@ void draw_circle_boundary(vec2 pos, GLfloat radius, GLuint color_hex) {
   GLint model_uni_loc = glGetUniformLocation(SHADER(), "model");
   glUniformMatrix4fv(model_uni_loc, 1, GL_FALSE, (GLfloat*) model);
 
-  BUFFER_DRAW(GL_LINE_LOOP, 0, num_segments);
+  BUFFER_DRAW(GL_LINE_LOOP, first, num_segments);
 }
 
 void draw_rectangle_boundary(vec2 min, vec2 max, GLuint color_hex) {
@@ -188,8 +212,7 @@ void draw_rectangle_boundary(vec2 min, vec2 max, GLuint color_hex) {
 
   BUFFER_BIND();
   BUFFER_DEFINE_VERTEX_ATTRIBUTES(ATTR_POS | ATTR_CLR);
-  glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)sizeof(vertices),
-               vertices, GL_STATIC_DRAW);
+  GLint first = BUFFER_UPLOAD(vertices, sizeof(vertices));
   BUFFER_UNBIND();
 
   mat4 model = ID_MAT4;
@@ -201,7 +224,7 @@ void draw_rectangle_boundary(vec2 min, vec2 max, GLuint color_hex) {
   GLint model_uni_loc = glGetUniformLocation(SHADER(), "model");
   glUniformMatrix4fv(model_uni_loc, 1, GL_FALSE, (GLfloat*) model);
 
-  BUFFER_DRAW(GL_LINE_LOOP, 0, 4);
+  BUFFER_DRAW(GL_LINE_LOOP, first, 4);
 }
 
 void draw_rectangle_filled(vec2 min, vec2 max, GLuint color_hex) {
@@ -242,7 +265,7 @@ void draw_rectangle_filled(vec2 min, vec2 max, GLuint color_hex) {
     
     BUFFER_BIND(); 
     BUFFER_DEFINE_VERTEX_ATTRIBUTES(ATTR_POS | ATTR_CLR);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+    GLint first = BUFFER_UPLOAD(vertices, sizeof(vertices));
     BUFFER_UNBIND();
     
     mat4 model = ID_MAT4;
@@ -254,5 +277,5 @@ void draw_rectangle_filled(vec2 min, vec2 max, GLuint color_hex) {
     GLint model_uni_loc = glGetUniformLocation(SHADER(), "model");
     glUniformMatrix4fv(model_uni_loc, 1, GL_FALSE, (GLfloat*)&model);
     
-    BUFFER_DRAW(GL_TRIANGLES, 0, 6);
+    BUFFER_DRAW(GL_TRIANGLES, first, 6);
 }
@@ -0,0 +1,133 @@
+#include <math.h>
+
+#include "sap.h"
+#include "log.h"
+
+static inline double axis_of(vec2 q, sap_axis_t axis) {
+  return axis == SAP_AXIS_X ? q.x : q.y;
+}
+
+static inline double off_axis_of(vec2 q, sap_axis_t axis) {
+  return axis == SAP_AXIS_X ? q.y : q.x;
+}
+
+SweepAndPrune *sap_init(Bodies *bodies) {
+  SweepAndPrune *sap = (SweepAndPrune *) calloc(1, sizeof(SweepAndPrune));
+  if (sap == NULL) PANIC_WITH(SAP_ALLOC_FAIL);
+  sap->axis = SAP_AXIS_X;
+  sap->bodies = bodies;
+  return sap;
+}
+
+// bodies are added in index order, the next one is body len
+void sap_add(SweepAndPrune *sap, uint32_t body) {
+  if (sap->len == sap->cap) {
+    sap->cap = sap->cap ? 2 * sap->cap : 256;
+    sap->intervals = realloc(sap->intervals, sap->cap * sizeof(SapInterval));
+    if (!sap->intervals) PANIC_WITH(SAP_ALLOC_FAIL);
+  }
+  Bodies *b = sap->bodies;
+  double c = axis_of(body_q(b, body), sap->axis), R = b->R[body];
+  sap->intervals[sap->len++] = (SapInterval){ c - R, c + R, body };
+}
+
+// sweep along whichever axis has the larger positional variance, the
+// other one has to beat the current one by SAP_AXIS_HYSTERESIS so near
+// equal spreads do not flip the axis back and forth
+static sap_axis_t dominant_axis(SweepAndPrune *sap) {
+  if (sap->len < 2) return sap->axis;
+  double sx = 0, sy = 0, sxx = 0, syy = 0;
+  for (size_t k = 0; k < sap->len; k++) {
+    vec2 q = body_q(sap->bodies, k);
+    sx += q.x; sxx += q.x * q.x;
+    sy += q.y; syy += q.y * q.y;
+  }
+  double n = (double) sap->len;
+  double var_x = sxx / n - (sx / n) * (sx / n);
+  double var_y = syy / n - (sy / n) * (sy / n);
+  if (sap->axis == SAP_AXIS_X) {
+    return var_y > SAP_AXIS_HYSTERESIS * var_x ? SAP_AXIS_Y : SAP_AXIS_X;
+  }
+  return var_x > SAP_AXIS_HYSTERESIS * var_y ? SAP_AXIS_X : SAP_AXIS_Y;
+}
+
+static int interval_cmp(const void *a, const void *b) {
+  double la = ((const SapInterval *) a)->lo, lb = ((const SapInterval *) b)->lo;
+  return (la > lb) - (la < lb);
+}
+
+void sap_update(SweepAndPrune *sap) {
+  if (sap->updates++ % SAP_AXIS_EVERY == 0) {
+    sap_axis_t axis = dominant_axis(sap);
+    if (axis != sap->axis) sap->resort = true;
+    sap->axis = axis;
+  }
+  SapInterval *iv = sap->intervals;
+  Bodies *b = sap->bodies;
+  for (size_t k = 0; k < sap->len; k++) {
+    uint32_t body = iv[k].body;
+    double c = axis_of(body_q(b, body), sap->axis), R = b->R[body];
+    iv[k].lo = c - R;
+    iv[k].hi = c + R;
+  }
+  // after an axis switch or a refill the old order says nothing
+  if (sap->resort) {
+    if (sap->len > 1) qsort(iv, sap->len, sizeof(SapInterval), interval_cmp);
+    sap->resort = false;
+    return;
+  }
+  // insertion sort, O(N + swaps) for coherent motion
+  for (size_t k = 1; k < sap->len; k++) {
+    SapInterval key = iv[k];
+    size_t m = k;
+    while (m > 0 && iv[m - 1].lo > key.lo) { iv[m] = iv[m - 1]; m--; }
+    iv[m] = key;
+  }
+}
+
+// follows entities_compact, the surviving intervals keep their order
+void sap_compact(SweepAndPrune *sap, const uint32_t *to, size_t len) {
+  size_t n = 0;
+  for (size_t k = 0; k < sap->len; k++) {
+    SapInterval iv = sap->intervals[k];
+    if (to[iv.body] == BODY_REMOVED) continue;
+    iv.body = to[iv.body];
+    sap->intervals[n++] = iv;
+  }
+  sap->len = len;
+}
+
+void sap_clear(SweepAndPrune *sap) {
+  sap->len = 0;
+  sap->updates = 0;
+  sap->resort = true;
+}
+
+void sap_free(SweepAndPrune *sap) {
+  if (sap == NULL) return;
+  free(sap->intervals);
+  free(sap);
+}
+
+// every interval is grown by margin on each side before testing overlap
+void sap_for_each_pair(SweepAndPrune *sap, double margin,
+                       pair_fn fn, void *ctx)
+{
+  const SapInterval *iv = sap->intervals;
+  Bodies *b = sap->bodies;
+  for (size_t k = 0; k < sap->len; k++) {
+    uint32_t p_k = iv[k].body;
+    double hi = iv[k].hi + 2.0 * margin;
+    for (size_t m = k + 1; m < sap->len && iv[m].lo <= hi; m++) {
+      uint32_t p_m = iv[m].body;
+      double reach = b->R[p_k] + b->R[p_m] + 2.0 * margin;
+      double d_k = off_axis_of(body_q(b, p_k), sap->axis);
+      double d_m = off_axis_of(body_q(b, p_m), sap->axis);
+      if (fabs(d_k - d_m) <= reach) fn(b, p_k, p_m, ctx);
+    }
+  }
+}
+
+void sap_apply_collisions(SweepAndPrune *sap) {
+  sap_for_each_pair(sap, 0.0, pair_impulsive_collision, NULL);
+}
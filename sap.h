@@ -0,0 +1,40 @@
+#ifndef SAP_H_
+#define SAP_H_
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "physics.h"
+
+#define SAP_AXIS_EVERY      32   // updates between looks at the axis
+#define SAP_AXIS_HYSTERESIS 1.2  // variance ratio needed to switch
+
+typedef enum { SAP_AXIS_X, SAP_AXIS_Y } sap_axis_t;
+
+typedef struct {
+  double lo, hi;  // body extent along the sweep axis
+  uint32_t body;
+} SapInterval;
+
+// intervals stay sorted by lo between steps, so resorting is near linear
+typedef struct {
+  sap_axis_t axis;
+  size_t updates;
+  bool resort;          // order unrelated to lo, sort from scratch
+  size_t len;
+  size_t cap;
+  SapInterval *intervals;
+  Bodies *bodies;
+} SweepAndPrune;
+
+SweepAndPrune *sap_init(Bodies *);
+void sap_add(SweepAndPrune *, uint32_t);
+void sap_update(SweepAndPrune *);
+void sap_compact(SweepAndPrune *, const uint32_t *, size_t);
+void sap_clear(SweepAndPrune *);
+void sap_free(SweepAndPrune *);
+
+void sap_for_each_pair(SweepAndPrune *, double, pair_fn, void *);
+void sap_apply_collisions(SweepAndPrune *);
+
+#endif // SAP_H_
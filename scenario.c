@@ -0,0 +1,159 @@
+#include <string.h>
+
+#include "scenario.h"
+#include "config.h"
+#include "log.h"
+
+#define CLUSTER_SEED 0x9E3779B97F4A7C15ull  // keeps clusters off body streams
+
+static const char *SCENARIO_NAMES[SCENARIO_TOTAL] = {
+  "uniform", "plummer", "disk", "cluster",
+};
+
+typedef struct {
+  Scenario *sc;
+  PhysicsEntity *out;
+  size_t first;  // index of out[0] among all the bodies
+  size_t clusters;
+  vec2 centers[SCENARIO_MAX_CLUSTERS];
+  vec2 drift[SCENARIO_MAX_CLUSTERS];
+} ScenarioJob;
+
+static vec2 rand_dir(RandStream *rs) {
+  double phi = 2.0 * M_PI * rand_unit(rs);
+  return (vec2){ cos(phi), sin(phi) };
+}
+
+// in scale radii, from the inverse of the plummer mass profile, redrawn
+// past the cutoff
+static double plummer_radius(RandStream *rs, double cutoff) {
+  for (;;) {
+    double u = rand_unit(rs);
+    if (u == 0.0) continue;
+    double r = 1.0 / sqrt(1.0 / cbrt(u * u) - 1.0);
+    if (r <= cutoff) return r;
+  }
+}
+
+// aarseth's rejection sampling of q = v / v_escape
+static double plummer_speed(RandStream *rs, double r) {
+  double q, g, w;
+  do {
+    q = rand_unit(rs);
+    g = 0.1 * rand_unit(rs);
+    w = 1.0 - q * q;
+  } while (g > q * q * w * w * w * sqrt(w));  // q^2 (1 - q^2)^3.5
+  return q * M_SQRT2 / sqrt(sqrt(1.0 + r * r));
+}
+
+// how many scale radii fit between c and the nearest window edge
+static double plummer_fit(vec2 c, double radius) {
+  double room = fmin(fmin(c.x, WIN_W - c.x), fmin(c.y, WIN_H - c.y));
+  return fmin(PLUMMER_CUTOFF, room / radius);
+}
+
+static void plummer_body(RandStream *rs, vec2 c, double radius,
+                         double speed, vec2 *q, vec2 *v)
+{
+  double r = plummer_radius(rs, plummer_fit(c, radius));
+  *q = vec2add(c, vec2scale(radius * r, rand_dir(rs)));
+  *v = vec2scale(speed * plummer_speed(rs, r), rand_dir(rs));
+}
+
+static PhysicsEntity scenario_body(ScenarioJob *job, size_t i) {
+  Scenario *sc = job->sc;
+  RandStream rs = rand_stream(sc->seed, i);
+  vec2 q, v;
+  GLuint color;
+  switch (sc->kind) {
+  case SCENARIO_PLUMMER:
+    plummer_body(&rs, sc->center, sc->radius, sc->speed, &q, &v);
+    color = palette_color(rand_u32(&rs));
+    break;
+  case SCENARIO_DISK: {
+    // uniform surface density, rotating counterclockwise and faster
+    // outwards, with a little dispersion on top
+    double r = sc->radius * sqrt(rand_unit(&rs));
+    vec2 u = rand_dir(&rs);
+    q = vec2add(sc->center, vec2scale(r, u));
+    v = vec2scale(sc->speed * sqrt(r / sc->radius), (vec2){ -u.y, u.x });
+    v = vec2add(v, vec2scale(0.05 * sc->speed * rand_unit(&rs),
+                             rand_dir(&rs)));
+    color = palette_color(rand_u32(&rs));
+    break;
+  }
+  case SCENARIO_CLUSTER: {
+    int c = rand_range(&rs, 0, (int) job->clusters - 1);
+    plummer_body(&rs, job->centers[c], sc->radius, sc->speed, &q, &v);
+    v = vec2add(v, job->drift[c]);
+    color = palette_color((uint32_t) c);
+    break;
+  }
+  case SCENARIO_UNIFORM:
+  default:
+    q = (vec2){ WIN_W * rand_unit(&rs), WIN_H * rand_unit(&rs) };
+    v = (vec2){ sc->speed * (2.0 * rand_unit(&rs) - 1.0),
+                sc->speed * (2.0 * rand_unit(&rs) - 1.0) };
+    color = palette_color(rand_u32(&rs));
+  }
+  return new_physics_entity(q, v, (vec2){ 0.0, 0.0 }, sc->mass, color);
+}
+
+static void scenario_job(void *arg, size_t begin, size_t end, size_t worker)
+{
+  (void) worker;
+  ScenarioJob *job = (ScenarioJob *) arg;
+  for (size_t i = begin; i < end; i++) {
+    job->out[i] = scenario_body(job, job->first + i);
+  }
+}
+
+// fills out[0, n). with jobs the bodies are made in parallel, without
+// them on the calling thread, the result is the same either way
+void scenario_generate(Scenario *sc, PhysicsEntity *out, size_t n,
+                       JobSystem *jobs)
+{
+  scenario_generate_range(sc, out, 0, n, jobs);
+}
+
+// bodies [first, first + n) into out[0, n), so a world too big for memory
+// can be made a piece at a time
+void scenario_generate_range(Scenario *sc, PhysicsEntity *out, size_t first,
+                             size_t n, JobSystem *jobs)
+{
+  ScenarioJob job = { .sc = sc, .out = out, .first = first };
+  if (sc->kind == SCENARIO_CLUSTER) {
+    job.clusters = sc->clusters;
+    if (job.clusters == 0) job.clusters = 1;
+    if (job.clusters > SCENARIO_MAX_CLUSTERS) {
+      job.clusters = SCENARIO_MAX_CLUSTERS;
+    }
+    double margin = fmin(3.0 * sc->radius, 0.25 * WIN_H);
+    for (size_t c = 0; c < job.clusters; c++) {
+      RandStream rs = rand_stream(sc->seed ^ CLUSTER_SEED, c);
+      job.centers[c] = (vec2){
+        margin + (WIN_W - 2.0 * margin) * rand_unit(&rs),
+        margin + (WIN_H - 2.0 * margin) * rand_unit(&rs),
+      };
+      job.drift[c] = vec2scale(0.5 * sc->speed * rand_unit(&rs),
+                               rand_dir(&rs));
+    }
+  }
+  if (jobs == NULL) {
+    scenario_job(&job, 0, n, 0);
+    return;
+  }
+  jobs_parallel_for(jobs, NULL, n, SCENARIO_GRAIN, scenario_job, &job);
+  jobs_run(jobs);
+}
+
+scenario_t scenario_from_name(const char *name) {
+  for (size_t k = 0; k < SCENARIO_TOTAL; k++) {
+    if (strcmp(name, SCENARIO_NAMES[k]) == 0) return (scenario_t) k;
+  }
+  PANIC_WITH(SCENARIO_UNKNOWN);
+}
+
+const char *scenario_name(scenario_t kind) {
+  return kind < SCENARIO_TOTAL ? SCENARIO_NAMES[kind] : "?";
+}
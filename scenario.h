@@ -0,0 +1,39 @@
+#ifndef SCENARIO_H_
+#define SCENARIO_H_
+#include <stddef.h>
+#include <stdint.h>
+
+#include "physics.h"
+#include "jobs.h"
+
+#define SCENARIO_GRAIN        4096  // bodies per job
+#define SCENARIO_MAX_CLUSTERS 64
+#define PLUMMER_CUTOFF        10.0  // in scale radii
+
+typedef enum {
+  SCENARIO_UNIFORM,   // the whole window, velocities uniform in a box
+  SCENARIO_PLUMMER,   // one relaxed ball around center
+  SCENARIO_DISK,      // a rotating disk around center
+  SCENARIO_CLUSTER,   // plummer balls scattered over the window
+  SCENARIO_TOTAL,
+} scenario_t;
+
+typedef struct {
+  scenario_t kind;
+  uint64_t seed;
+  vec2 center;
+  double radius;      // plummer scale radius, disk radius
+  double speed;       // velocity scale
+  double mass;        // of every body
+  size_t clusters;
+} Scenario;
+
+// body i only ever draws from stream i of the seed, so the bodies come
+// out the same whatever the number of workers or how they split the work
+void scenario_generate(Scenario *, PhysicsEntity *, size_t, JobSystem *);
+void scenario_generate_range(Scenario *, PhysicsEntity *, size_t, size_t,
+                             JobSystem *);
+scenario_t scenario_from_name(const char *);
+const char *scenario_name(scenario_t);
+
+#endif // SCENARIO_H_
@@ -0,0 +1,298 @@
+#include "sim.h"
+#include "config.h"
+#include "log.h"
+
+Simulation *sim_init(SimConfig cfg) {
+  Simulation *s = (Simulation *) calloc(1, sizeof(Simulation));
+  if (s == NULL) PANIC_WITH(SIM_ALLOC_FAIL);
+  s->entities = entities_init(cfg.max_bodies);
+  s->bodies   = &s->entities->store;
+  s->arena    = arena_init(cfg.arena_bytes, cfg.arena_strat);
+  s->ptree_stale = true;
+  s->hash     = init_spatial_hash(SIM_SECTOR_SIZE, s->bodies);
+  s->sap      = sap_init(s->bodies);
+  s->nlist    = nlist_init(SIM_NLIST_SKIN, s->bodies);
+  s->bvh      = bvh_init(s->bodies);
+  s->contacts = contacts_init(s->bodies);
+  s->islands  = islands_init(cfg.island_workers);
+  s->events   = events_init(cfg.initial_bodies, RESTITUTION,
+                            cfg.arena_strat);
+  s->jobs     = cfg.job_workers > 0 ? jobs_init(cfg.job_workers) : NULL;
+
+  s->sink.q = WIN_CENTER;
+  atomic_init(&s->sink.M, SIM_SINK_MASS);
+
+  s->broadphase = BROADPHASE_TREE_ONCE;
+  s->use_sleep = true;
+  s->use_ccd = true;
+  s->use_contact_solver = true;
+  s->use_islands = true;
+  s->use_events = false;
+  s->use_jobs = s->jobs != NULL;
+  return s;
+}
+
+void sim_free(Simulation *s) {
+  if (s == NULL) return;
+  spatial_hash_free(s->hash);
+  sap_free(s->sap);
+  nlist_free(s->nlist);
+  bvh_free(s->bvh);
+  contacts_free(s->contacts);
+  islands_free(s->islands);
+  jobs_free(s->jobs);
+  events_free(s->events);
+  entities_free(s->entities);
+  arena_reset(s->arena);
+  arena_free(s->arena);
+  free(s);
+}
+
+static void job_prefault(void *arg, size_t begin, size_t end,
+                         size_t worker)
+{
+  (void) worker;
+  Simulation *s = (Simulation *) arg;
+  entities_touch(s->entities, begin, end);
+}
+
+// commits the store for n bodies and faults each chunk in from the job
+// worker that runs it, split the way jobs_for_bodies splits n live
+// bodies. with pinned workers first touch puts a chunk's pages on that
+// worker's node. it is best effort: chunks are stolen rather than dealt
+// out, so a later step may run one elsewhere, and a page shared by two
+// chunks goes to whichever touched it first
+void sim_prefault(Simulation *s, size_t n) {
+  entities_grow(s->entities, n);
+  if (s->jobs == NULL) return;
+  jobs_parallel_for(s->jobs, NULL, n, SIM_JOB_GRAIN, job_prefault, s);
+  jobs_run(s->jobs);
+}
+
+// the body is not in any broadphase until sim_index_from, spawn a batch
+// and index it once
+BodyHandle sim_spawn(Simulation *s, PhysicsEntity e) {
+  physics_entity_bind_geometry(&e, GEOM_CIRCLE, (Geometry){
+      .circ.R = 0.08 * e.m
+  });
+  s->ptree_stale = true;
+  return entities_spawn(s->entities, e);
+}
+
+// only the broadphase in use is kept indexed, the other structures stay
+// empty. the tree ones are rebuilt from the bodies and keep nothing
+static void index_range(Simulation *s, size_t first) {
+  for (size_t P = first; P < s->bodies->len; P++) {
+    uint32_t p = (uint32_t) P;
+    switch (s->broadphase) {
+    case BROADPHASE_HASH:  add_entity_to_spatial_hash(s->hash, p); break;
+    case BROADPHASE_SAP:   sap_add(s->sap, p); break;
+    case BROADPHASE_NLIST: nlist_add(s->nlist, p); break;
+    case BROADPHASE_BVH:   bvh_add(s->bvh, p); break;
+    default: return;
+    }
+  }
+}
+
+static void unindex_all(Simulation *s) {
+  spatial_hash_clear(s->hash);
+  sap_clear(s->sap);
+  nlist_clear(s->nlist);
+  bvh_clear(s->bvh);
+}
+
+// indexes bodies [first, len) in one go, only they are scheduled in the
+// event queue
+void sim_index_from(Simulation *s, size_t first) {
+  if (s->bodies->len <= first) return;
+  index_range(s, first);
+  if (s->use_events) events_add(s->events, s->bodies);
+}
+
+// the new broadphase is filled from scratch, the old one is emptied
+void sim_set_broadphase(Simulation *s, broadphase_t bp) {
+  unindex_all(s);
+  s->broadphase = bp;
+  index_range(s, 0);
+}
+
+// removes the despawned bodies. compaction only moves bodies from the tail
+// into holes, so the broadphases and the warm start cache fix up those
+// slots instead of being refilled. returns how many went
+size_t sim_compact(Simulation *s) {
+  Bodies *b = s->bodies;
+  if (s->entities->dead_len == 0) return 0;
+  ArenaMarker mark = arena_mark(s->arena);
+  uint32_t *to = arena_alloc_tagged(s->arena, b->len * sizeof(uint32_t),
+                                    "compaction map");
+  size_t removed = entities_compact(s->entities, to);
+  switch (s->broadphase) {
+  case BROADPHASE_HASH:  spatial_hash_compact(s->hash, to, b->len); break;
+  case BROADPHASE_SAP:   sap_compact(s->sap, to, b->len); break;
+  case BROADPHASE_NLIST: nlist_compact(s->nlist, to, b->len); break;
+  case BROADPHASE_BVH:   bvh_compact(s->bvh, to, b->len); break;
+  default: break;
+  }
+  contacts_compact(s->contacts, to);
+  if (s->use_events) events_reset(s->events, b);
+  arena_release(s->arena, mark);
+  s->ptree_stale = true;
+  return removed;
+}
+
+// every cache of body indices is refilled from scratch
+void sim_reindex(Simulation *s) {
+  s->ptree_stale = true;
+  unindex_all(s);
+  contacts_clear(s->contacts);
+  index_range(s, 0);
+  if (s->use_events) events_reset(s->events, s->bodies);
+}
+
+void sim_clear(Simulation *s) {
+  entities_clear(s->entities);
+  s->ptree = NULL;
+  sim_reindex(s);
+}
+
+void sim_rebuild_tree(Simulation *s) {
+  arena_reset(s->arena);
+  arena_autosize(s->arena, SIM_ARENA_HEADROOM);
+  s->ptree = bhtree_init(s->bodies, s->arena);
+  s->ptree_stale = false;
+}
+
+void sim_tree_job(void *arg, size_t begin, size_t end, size_t worker) {
+  (void) begin; (void) end; (void) worker;
+  sim_rebuild_tree((Simulation *) arg);
+}
+
+// the per-body halves of a step, each body only ever touches itself, so
+// a job streams through one contiguous range of every array it reads
+static void job_position_step(void *arg, size_t begin, size_t end,
+                              size_t worker)
+{
+  (void) worker;
+  Simulation *s = (Simulation *) arg;
+  Bodies *b = s->bodies;
+  for (size_t i = begin; i < end; i++) {
+    if (physics_is_asleep(b, i)) continue;
+    physics_verlet_pos(b, i, s->step_dt);
+    physics_apply_boundaries(b, i);
+  }
+}
+
+static void job_velocity_step(void *arg, size_t begin, size_t end,
+                              size_t worker)
+{
+  (void) worker;
+  Simulation *s = (Simulation *) arg;
+  Bodies *b = s->bodies;
+  for (size_t i = begin; i < end; i++) {
+    force_singular_gravity(b, i, &s->sink);
+    if (!physics_is_asleep(b, i)) physics_verlet_vel(b, i, s->step_dt);
+    if (s->use_sleep) physics_update_sleep(b, i, s->step_dt);
+    b->ax[i] = 0.0;
+    b->ay[i] = 0.0;
+  }
+}
+
+static void jobs_for_bodies(Simulation *s, job_fn *fn) {
+  jobs_parallel_for(s->jobs, NULL, s->bodies->len, SIM_JOB_GRAIN, fn, s);
+  jobs_run(s->jobs);
+}
+
+static void broadphase_for_each_pair(Simulation *s, pair_fn fn, void *ctx) {
+  switch (s->broadphase) {
+  case BROADPHASE_HASH:
+    spatial_hash_update(s->hash);
+    spatial_hash_for_each_pair(s->hash, fn, ctx);
+    break;
+  case BROADPHASE_SAP:
+    sap_update(s->sap);
+    sap_for_each_pair(s->sap, 0.0, fn, ctx);
+    break;
+  case BROADPHASE_NLIST:
+    nlist_update(s->nlist);
+    nlist_for_each_pair(s->nlist, fn, ctx);
+    break;
+  case BROADPHASE_BVH:
+    bvh_update(s->bvh);
+    bvh_for_each_pair(s->bvh, fn, ctx);
+    break;
+  case BROADPHASE_TREE:
+  case BROADPHASE_TREE_ONCE:
+  default:
+    bhtree_for_each_pair(s->bodies, s->ptree, fn, ctx);
+  }
+}
+
+static void apply_collisions(Simulation *s) {
+  if (s->use_contact_solver) {
+    contacts_begin(s->contacts);
+    broadphase_for_each_pair(s, contact_emit, s->contacts);
+    if (s->use_islands) {
+      islands_solve(s->islands, s->contacts, s->bodies->len,
+                    CONTACT_ITERATIONS, RESTITUTION);
+    } else {
+      contacts_solve(s->contacts, CONTACT_ITERATIONS, RESTITUTION);
+    }
+  } else if (s->broadphase == BROADPHASE_TREE) {
+    bhtree_apply_collisions(s->bodies, s->ptree);
+  } else {
+    broadphase_for_each_pair(s, pair_impulsive_collision, NULL);
+  }
+}
+
+// one fixed step against the tree as it was last built
+void sim_step(Simulation *s, double dt) {
+  bool jobs = s->use_jobs && s->jobs;
+  Bodies *b = s->bodies;
+  s->step_dt = dt;
+  s->steps++;
+  if (s->use_events) {
+    events_run(s->events, dt);
+    return;
+  }
+  if (s->use_ccd) bhtree_apply_ccd(b, s->ptree, dt);
+  if (jobs) {
+    jobs_for_bodies(s, job_position_step);
+  } else {
+    bhtree_integrate(VERLET_POS, b, s->ptree, dt);
+    bhtree_apply_boundaries(b, s->ptree);
+  }
+  apply_collisions(s);
+  if (jobs) {
+    jobs_for_bodies(s, job_velocity_step);
+    return;
+  }
+  bhtree_apply_singular_gravity(b, s->ptree, &s->sink);
+  bhtree_integrate(VERLET_VEL, b, s->ptree, dt);
+  if (s->use_sleep) bhtree_update_sleep(b, s->ptree, dt);
+  bhtree_clear_forces(b, s->ptree);
+}
+
+// after the steps of a frame: bodies swallowed by the sink leave the
+// simulation for good, the event engine hands its state back
+void sim_settle(Simulation *s) {
+  EntityArray *ea = s->entities;
+  if (s->use_events) {
+    events_sync(s->events);
+    return;
+  }
+  for (size_t n = 0; n < s->bodies->len; n++) {
+    if (physics_captured_by_sink(s->bodies, n, s->sink.q)) {
+      entities_despawn(ea, entities_handle_of(ea, n));
+    }
+  }
+  sim_compact(s);
+}
+
+// headless stepping, no clock: a fresh tree for every step
+void sim_advance(Simulation *s, size_t steps, double dt) {
+  for (size_t k = 0; k < steps; k++) {
+    sim_rebuild_tree(s);
+    sim_step(s, dt);
+    sim_settle(s);
+  }
+}
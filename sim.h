@@ -0,0 +1,94 @@
+#ifndef SIM_H_
+#define SIM_H_
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "alloc.h"
+#include "physics.h"
+#include "tree.h"
+#include "hash.h"
+#include "sap.h"
+#include "nlist.h"
+#include "contact.h"
+#include "island.h"
+#include "bvh.h"
+#include "events.h"
+#include "entities.h"
+#include "jobs.h"
+
+#define SIM_SECTOR_SIZE    20
+#define SIM_NLIST_SKIN     4.0
+#define SIM_JOB_GRAIN      128
+#define SIM_ARENA_HEADROOM 0.25
+#define SIM_SINK_MASS      10.0
+
+typedef enum {
+  BROADPHASE_TREE,
+  BROADPHASE_TREE_ONCE,
+  BROADPHASE_HASH,
+  BROADPHASE_SAP,
+  BROADPHASE_NLIST,
+  BROADPHASE_BVH,
+  BROADPHASE_TOTAL,
+} broadphase_t;
+
+typedef struct {
+  size_t max_bodies;        // address space reserved for bodies
+  size_t initial_bodies;    // sizes the first commits, not a limit
+  size_t arena_bytes;       // initial frame arena commit, autosized after
+  page_strat_t arena_strat; // frame and event arenas
+  size_t job_workers;       // 0 steps everything on the calling thread
+  size_t island_workers;    // 0 or 1 solves islands on the calling thread
+} SimConfig;
+
+// everything one simulation owns. nothing here is shared with another
+// Simulation, so any number of them can step side by side on different
+// threads as long as each is only ever stepped by one thread at a time
+typedef struct Simulation {
+  EntityArray *entities; // handles and the memory behind the store
+  Bodies *bodies;        // &entities->store
+  MemoryArena *arena;   // the tree, reset on every rebuild
+  BHNode *ptree;
+  bool ptree_stale;     // anything that changes the body set sets this
+
+  SpatialHash *hash;
+  SweepAndPrune *sap;
+  NeighborList *nlist;
+  DynamicTree *bvh;
+  ContactBuffer *contacts;
+  IslandSolver *islands;
+  EventSim *events;
+  JobSystem *jobs;      // NULL without job workers
+
+  Sink sink;
+  PhysicsClock clock;
+  double step_dt;       // of the step in progress, read by the job kernels
+  size_t steps;
+
+  broadphase_t broadphase;
+  bool use_sleep;
+  bool use_ccd;
+  bool use_contact_solver;
+  bool use_islands;
+  bool use_events;
+  bool use_jobs;
+} Simulation;
+
+Simulation *sim_init(SimConfig);
+void sim_free(Simulation *);
+
+void sim_prefault(Simulation *, size_t);
+BodyHandle sim_spawn(Simulation *, PhysicsEntity);
+void sim_index_from(Simulation *, size_t);
+size_t sim_compact(Simulation *);
+void sim_set_broadphase(Simulation *, broadphase_t);
+void sim_reindex(Simulation *);
+void sim_clear(Simulation *);
+
+void sim_rebuild_tree(Simulation *);
+void sim_tree_job(void *, size_t, size_t, size_t);
+void sim_step(Simulation *, double);
+void sim_settle(Simulation *);
+void sim_advance(Simulation *, size_t, double);
+
+#endif // SIM_H_
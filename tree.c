@@ -6,33 +6,19 @@
 #include "config.h"
 
 BH_NODE_MAP(bhtree_clear_forces, {
-  PhysicsEntity *body = node->bodies[n];
-  if (body) node->bodies[n]->d2q_dt2 = ((vec2){0.0f, 0.0f});
+  uint32_t body = node->bodies[n];
+  if (body != BH_NO_BODY) { b->ax[body] = 0.0f; b->ay[body] = 0.0f; }
 })
 
 BH_NODE_MAP(bhtree_apply_boundaries, {
-  PhysicsEntity *body = node->bodies[n];
-  if (body) {
-    if (body->q.x - body->geom.circ.R <= 0.0) {
-      body->dq_dt.x *= -1;
-      body->q.x = body->geom.circ.R;
-    } else if (body->q.x + body->geom.circ.R >= WIN_W) {
-      body->dq_dt.x *= -1;
-      body->q.x = WIN_W - body->geom.circ.R;
-    }
-    if (body->q.y - body->geom.circ.R <= 0.0) {
-      body->dq_dt.y *= -1;
-      body->q.y = body->geom.circ.R;
-    } else if (body->q.y + body->geom.circ.R >= WIN_H) {
-      body->dq_dt.y *= -1;
-      body->q.y = WIN_H - body->geom.circ.R;
-    }
+  uint32_t body = node->bodies[n];
+  if (body != BH_NO_BODY && !physics_is_asleep(b, body)) {
+    physics_apply_boundaries(b, body);
   }
 })
 
-static void draw_quad(BHNode *node) {
-  if (!node) return;
-  EACH_QUAD(node->min, node->max, {
+static void draw_quad(vec2 min, vec2 max) {
+  EACH_QUAD(min, max, {
     draw_rectangle_boundary(__qmin, __qmax, 0xFF0000FF);
   });
 }
@@ -47,32 +33,53 @@ static Quad quad_map(BHNode *node, vec2 pos) {
 
 void bhtree_draw_quads(BHNode *node, GLuint color) {
   if (!node) return;
-  draw_quad(node);
+  draw_quad(node->min, node->max);
   draw_circle(node->cm, 3.0, 0xFFFFFFFF);
   for (size_t n = 0; n < MAX_CHILDREN; n++) {
     bhtree_draw_quads(node->children[n], color);
   }
 }
 
+// copies up to cap nodes in draw order, returns how many the tree has so
+// the caller can grow and retry
+size_t bhtree_snapshot_quads(BHNode *node, QuadBox *out, size_t cap) {
+  if (!node) return 0;
+  if (cap > 0) *out = (QuadBox){ node->min, node->max, node->cm };
+  size_t total = 1;
+  for (size_t n = 0; n < MAX_CHILDREN; n++) {
+    size_t room = cap > total ? cap - total : 0;
+    total += bhtree_snapshot_quads(node->children[n],
+                                   room ? out + total : NULL, room);
+  }
+  return total;
+}
+
+void draw_quad_boxes(QuadBox *boxes, size_t len) {
+  for (size_t b = 0; b < len; b++) {
+    draw_quad(boxes[b].min, boxes[b].max);
+    draw_circle(boxes[b].cm, 3.0, 0xFFFFFFFF);
+  }
+}
+
 BHNode *bhtree_create(MemoryArena *arena, vec2 min, vec2 max) {
-  BHNode *node = (BHNode *) arena_alloc(arena, sizeof(BHNode));
+  BHNode *node = (BHNode *) arena_alloc_tagged(arena, sizeof(BHNode),
+                                               "bhtree node");
   node->min = min; node->max = max;
   node->body_total = 0; node->is_partitioned = false;
   node->occ_state = OCC_0;
   node->cm = (vec2){-1.0, -1.0};
   node->m = 0.0;
   for (int n = 0; n < MAX_CHILDREN; n++) node->children[n] = NULL;
-  for (int n = 0; n < NUM_QUADS;    n++)   node->bodies[n] = NULL;
+  for (int n = 0; n < NUM_QUADS;    n++)   node->bodies[n] = BH_NO_BODY;
+  for (int n = 0; n < NUM_QUADS;    n++)   node->lnodes[n] = NULL;
   return node;
 }
 
-BHNode *
-bhtree_init(size_t N,
-            PhysicsEntity particles[static N],
-            MemoryArena arena[static 1])
-{
+BHNode *bhtree_init(Bodies *b, MemoryArena arena[static 1]) {
   BHNode *bh = bhtree_create(arena, (vec2){0.0, 0.0}, (vec2){WIN_W, WIN_H});
-  for (size_t n = 0; n < N; n++) bhtree_insert(arena, bh, &particles[n]);
+  for (size_t n = 0; n < b->len; n++) {
+    bhtree_insert(arena, b, bh, (uint32_t) n);
+  }
   return bh;
 }
 
@@ -113,80 +120,88 @@ static BHNode *child_partition(MemoryArena *arena, BHNode *parent, Quad q) {
   return parent->children[q];
 }
 
-static void update_cm(BHNode *node, PhysicsEntity *body) {
-  node->m += body->m;
+static void update_cm(Bodies *b, BHNode *node, uint32_t body) {
+  node->m += b->m[body];
   node->body_total++;
   node->cm = vec2scale(1 / (node->m),
-                       vec2add(vec2scale(node->m - body->m, node->cm),
-                               vec2scale(body->m, body->q)));
+                       vec2add(vec2scale(node->m - b->m[body], node->cm),
+                               vec2scale(b->m[body], body_q(b, body))));
 }
 
-static void insert_body(BHNode *node, PhysicsEntity *body) {
-  const Quad quad_target = quad_map(node, body->q);
+static void insert_body(Bodies *b, BHNode *node, uint32_t body) {
+  const Quad quad_target = quad_map(node, body_q(b, body));
   node->bodies[quad_target] = body;
   node->occ_state |= quad_to_occ(quad_target);
 }
 
-static PhysicsEntity *remove_body_at_quad(BHNode *node, Quad quad) {
-  PhysicsEntity *body = node->bodies[quad];
-  if (body) node->bodies[quad] = NULL;
+static uint32_t remove_body_at_quad(BHNode *node, Quad quad) {
+  uint32_t body = node->bodies[quad];
+  node->bodies[quad] = BH_NO_BODY;
   return body;
 }
 
-void bhtree_insert(MemoryArena *arena, BHNode *node, PhysicsEntity *body) {
+void bhtree_insert(MemoryArena *arena, Bodies *b, BHNode *node,
+                   uint32_t body)
+{
   if (!node) return;
-  if (!body_in_bounds(node->min, node->max, body->q)) return;
+  if (!body_in_bounds(node->min, node->max, body_q(b, body))) return;
 
-  update_cm(node, body);
+  update_cm(b, node, body);
 
-  const Quad quad_target = quad_map(node, body->q);
+  const Quad quad_target = quad_map(node, body_q(b, body));
   if (!(node->occ_state & quad_to_occ(quad_target))) {
-    insert_body(node, body);
+    insert_body(b, node, body);
     return;
   }
 
-  PhysicsEntity *cobody = remove_body_at_quad(node, quad_target);
-  if (cobody) {
+  uint32_t cobody = remove_body_at_quad(node, quad_target);
+  if (cobody != BH_NO_BODY) {
     BHNode *child = child_partition(arena, node, quad_target);
     if (!child) PANIC_WITH(BH_CHILD_NODE_DOES_NOT_EXIST);
-    bhtree_insert(arena, child, body);
-    bhtree_insert(arena, child, cobody);
+    bhtree_insert(arena, b, child, body);
+    bhtree_insert(arena, b, child, cobody);
     return;
   }
 
   for (size_t n = 0; n < MAX_CHILDREN; n++)
-    bhtree_insert(arena, node->children[n], body);
+    bhtree_insert(arena, b, node->children[n], body);
 
   return;
 }
 
-void bhtree_draw(BHNode *node) {
+void bhtree_draw(Bodies *b, BHNode *node) {
   if (!node) return;
   for (size_t n = 0; n < NUM_QUADS; n++) {
-    PhysicsEntity *body = node->bodies[n];
-    if (body) draw_circle(body->q, (GLfloat)body->geom.circ.R, body->color);
+    uint32_t body = node->bodies[n];
+    if (body == BH_NO_BODY) continue;
+    draw_circle(body_q(b, body), (GLfloat) b->R[body], b->color[body]);
   }
-  for (size_t n = 0; n < MAX_CHILDREN; n++) bhtree_draw(node->children[n]);
+  for (size_t n = 0; n < MAX_CHILDREN; n++) bhtree_draw(b, node->children[n]);
 }
 
-void bhtree_integrate(integration_flag flag, BHNode *node, double dt)
+void bhtree_integrate(integration_flag flag, Bodies *b, BHNode *node,
+                      double dt)
 {
   if (!node) return;
   for (size_t n = 0; n < NUM_QUADS; n++) {
-    PhysicsEntity *body = node->bodies[n];
-    if (body) {
-      if (flag & VERLET_POS) {
-        body->q.x += body->dq_dt.x * dt + 0.5 * body->d2q_dt2.x * dt * dt;
-        body->q.y += body->dq_dt.y * dt + 0.5 * body->d2q_dt2.y * dt * dt;
-      }
-      if (flag & VERLET_VEL) {
-        body->dq_dt.x += 0.5 * body->d2q_dt2.x * dt;
-        body->dq_dt.y += 0.5 * body->d2q_dt2.y * dt;
-      }
+    uint32_t body = node->bodies[n];
+    if (body != BH_NO_BODY && !physics_is_asleep(b, body)) {
+      if (flag & VERLET_POS) physics_verlet_pos(b, body, dt);
+      if (flag & VERLET_VEL) physics_verlet_vel(b, body, dt);
     }
   }
   for (size_t n = 0; n < MAX_CHILDREN; n++)
-    bhtree_integrate(flag, node->children[n], dt);
+    bhtree_integrate(flag, b, node->children[n], dt);
+}
+
+void bhtree_update_sleep(Bodies *b, BHNode *node, double dt) {
+  if (!node) return;
+  for (size_t n = 0; n < NUM_QUADS; n++) {
+    uint32_t body = node->bodies[n];
+    if (body != BH_NO_BODY) physics_update_sleep(b, body, dt);
+  }
+  for (size_t n = 0; n < MAX_CHILDREN; n++)
+    bhtree_update_sleep(b, node->children[n], dt);
 }
 
 BoundingBox generate_bounding_box(vec2 pos, double l) {
@@ -204,8 +219,12 @@ void draw_bounding_box(BoundingBox bbox, GLuint color) {
 
 static BHNodeRef bhnoderef_init(MemoryArena arena[static 1]) {
 #define MAX_NODES 100
+  ArenaMarker mark = arena_mark(arena);
   return (BHNodeRef) {
-    .nodes = (BHNode **) arena_alloc(arena, MAX_NODES * sizeof(BHNode *)),
+    .mark  = mark,
+    .nodes = (BHNode **) arena_alloc_tagged(arena,
+                                            MAX_NODES * sizeof(BHNode *),
+                                            "bhtree node refs"),
   };
 #undef MAX_NODES
 }
@@ -268,6 +287,13 @@ get_collision_nodes(MemoryArena arena[static 1], BHNode *root, BoundingBox box)
   return ref;
 }
 
+// drops the node list and anything allocated on the arena after it
+void release_collision_nodes(MemoryArena arena[static 1], BHNodeRef *ref) {
+  arena_release(arena, ref->mark);
+  ref->nodes = NULL;
+  ref->length = 0;
+}
+
 // TODO: strange behavior at boundaries!
 void least_bounding_node(BHNode *node, BHNode **lnode, BoundingBox box) {
   if (!node) return;
@@ -285,44 +311,198 @@ void least_bounding_node(BHNode *node, BHNode **lnode, BoundingBox box) {
 }
 
 static void
-bhtree_apply_subcollisions(size_t i, PhysicsEntity *p_i, BHNode *node)
+bhtree_apply_subcollisions(Bodies *b, uint32_t p_i, BHNode *node)
 {
   if (!node) return;
   for (size_t j = 0; j < NUM_QUADS; j++) {
-    PhysicsEntity *p_j = node->bodies[j];
-    if (p_i != p_j && p_j) force_pairwise_impulsive_collision(p_i, p_j);
+    uint32_t p_j = node->bodies[j];
+    if (p_i != p_j && p_j != BH_NO_BODY) {
+      force_pairwise_impulsive_collision(b, p_i, p_j);
+    }
   }
   for (size_t n = 0; n < MAX_CHILDREN; n++) {
-    bhtree_apply_subcollisions(-1, p_i, node->children[n]);
+    bhtree_apply_subcollisions(b, p_i, node->children[n]);
   }
 }
 
-void _bhtree_apply_collisions(BHNode *node, BHNode *root) {
+void _bhtree_apply_collisions(Bodies *b, BHNode *node, BHNode *root) {
   if (!node) return;
   for (size_t i = 0; i < NUM_QUADS; i++) {
-    PhysicsEntity *p_i = node->bodies[i];
-    if (p_i) {
-      BoundingBox pbox = generate_bounding_box(p_i->q, p_i->geom.circ.R);
+    uint32_t p_i = node->bodies[i];
+    if (p_i != BH_NO_BODY) {
+      BoundingBox pbox = generate_bounding_box(body_q(b, p_i), b->R[p_i]);
       BHNode *lnode = root;
       least_bounding_node(root, &lnode, pbox);
-      bhtree_apply_subcollisions(i, p_i, lnode);
+      bhtree_apply_subcollisions(b, p_i, lnode);
     }
   }
   for (size_t n = 0; n < MAX_CHILDREN; n++) {
-    _bhtree_apply_collisions(node->children[n], root);
+    _bhtree_apply_collisions(b, node->children[n], root);
   }
 }
 
-void bhtree_apply_singular_gravity(BHNode *node, vec2 sink_source) {
-  (void) sink_source;
+static bool node_contains(BHNode *outer, BHNode *inner) {
+  return outer->min.x <= inner->min.x && inner->max.x <= outer->max.x
+      && outer->min.y <= inner->min.y && inner->max.y <= outer->max.y;
+}
+
+static void bind_least_bounding_nodes(Bodies *b, BHNode *node, BHNode *root) {
   if (!node) return;
   for (size_t n = 0; n < NUM_QUADS; n++) {
-    PhysicsEntity *body = node->bodies[n];
-    if (body) force_singular_gravity(body, sink_source);
+    uint32_t body = node->bodies[n];
+    if (body == BH_NO_BODY) continue;
+    BoundingBox pbox = generate_bounding_box(body_q(b, body), b->R[body]);
+    node->lnodes[n] = root;
+    least_bounding_node(root, &node->lnodes[n], pbox);
+  }
+  for (size_t n = 0; n < MAX_CHILDREN; n++) {
+    bind_least_bounding_nodes(b, node->children[n], root);
+  }
+}
+
+// p_i (held by leaf) owns the pair unless p_j also reaches p_i from its
+// own least bounding node, in which case the lower index wins the tie
+static void owned_subpairs(Bodies *b, uint32_t p_i, BHNode *leaf,
+                           BHNode *node, pair_fn fn, void *ctx)
+{
+  if (!node) return;
+  for (size_t j = 0; j < NUM_QUADS; j++) {
+    uint32_t p_j = node->bodies[j];
+    if (p_j == BH_NO_BODY || p_i == p_j) continue;
+    bool mutual = node_contains(node->lnodes[j], leaf);
+    if (!mutual || p_i < p_j) fn(b, p_i, p_j, ctx);
+  }
+  for (size_t n = 0; n < MAX_CHILDREN; n++) {
+    owned_subpairs(b, p_i, leaf, node->children[n], fn, ctx);
+  }
+}
+
+static void owned_pairs(Bodies *b, BHNode *node, pair_fn fn, void *ctx) {
+  if (!node) return;
+  for (size_t i = 0; i < NUM_QUADS; i++) {
+    uint32_t p_i = node->bodies[i];
+    if (p_i != BH_NO_BODY) owned_subpairs(b, p_i, node, node->lnodes[i],
+                                          fn, ctx);
+  }
+  for (size_t n = 0; n < MAX_CHILDREN; n++) {
+    owned_pairs(b, node->children[n], fn, ctx);
+  }
+}
+
+// each candidate pair is handed to fn exactly once
+void bhtree_for_each_pair(Bodies *b, BHNode *root, pair_fn fn, void *ctx) {
+  bind_least_bounding_nodes(b, root, root);
+  owned_pairs(b, root, fn, ctx);
+}
+
+void bhtree_apply_collisions_once(Bodies *b, BHNode *root) {
+  bhtree_for_each_pair(b, root, pair_impulsive_collision, NULL);
+}
+
+static double ccd_reach(Bodies *b, BHNode *node, double dt) {
+  if (!node) return 0.0;
+  double reach = 0.0;
+  for (size_t n = 0; n < NUM_QUADS; n++) {
+    uint32_t body = node->bodies[n];
+    if (body == BH_NO_BODY) continue;
+    reach = fmax(reach, b->R[body] + vec2mag(body_v(b, body)) * dt);
+  }
+  for (size_t n = 0; n < MAX_CHILDREN; n++) {
+    reach = fmax(reach, ccd_reach(b, node->children[n], dt));
+  }
+  return reach;
+}
+
+static void ccd_first_hit(Bodies *b, uint32_t p_i, BHNode *node, double dt,
+                          uint32_t *hit, double *t_hit)
+{
+  if (!node) return;
+  for (size_t j = 0; j < NUM_QUADS; j++) {
+    uint32_t p_j = node->bodies[j];
+    if (p_j == BH_NO_BODY || p_j == p_i) continue;
+    double t = toi_swept_circles(b, p_i, p_j, dt);
+    if (t != TOI_NONE && t < *t_hit) { *t_hit = t; *hit = p_j; }
+  }
+  for (size_t n = 0; n < MAX_CHILDREN; n++) {
+    ccd_first_hit(b, p_i, node->children[n], dt, hit, t_hit);
+  }
+}
+
+// the body is moved to the impact, resolved, then pulled back along its
+// new velocity so the ordinary position step lands it on the true path
+static void ccd_advance(Bodies *b, uint32_t p, double t, vec2 v_old) {
+  body_set_q(b, p, vec2add(body_q(b, p), vec2scale(t, v_old)));
+}
+
+static void ccd_rewind(Bodies *b, uint32_t p, double t) {
+  body_set_q(b, p, vec2sub(body_q(b, p), vec2scale(t, body_v(b, p))));
+}
+
+static void ccd_resolve_body(Bodies *b, BHNode *root, uint32_t p_i,
+                             double dt, double reach)
+{
+  for (size_t e = 0; e < CCD_MAX_EVENTS; e++) {
+    vec2 wall_n;
+    double t_wall = toi_wall(b, p_i, dt, &wall_n);
+    double t_hit = t_wall != TOI_NONE ? t_wall : INFINITY;
+
+    vec2 sweep = vec2scale(dt, body_v(b, p_i));
+    vec2 mid = vec2add(body_q(b, p_i), vec2scale(0.5, sweep));
+    double l = 0.5 * fmax(fabs(sweep.x), fabs(sweep.y))
+             + b->R[p_i] + reach;
+    BHNode *lnode = root;
+    least_bounding_node(root, &lnode, generate_bounding_box(mid, l));
+
+    uint32_t hit = BH_NO_BODY;
+    ccd_first_hit(b, p_i, lnode, dt, &hit, &t_hit);
+
+    if (hit != BH_NO_BODY) {
+      ccd_advance(b, p_i, t_hit, body_v(b, p_i));
+      ccd_advance(b, hit, t_hit, body_v(b, hit));
+      vec2 n = vec2norm(vec2sub(body_q(b, hit), body_q(b, p_i)));
+      physics_collide_velocities(b, p_i, hit, n, RESTITUTION);
+      ccd_rewind(b, p_i, t_hit);
+      ccd_rewind(b, hit, t_hit);
+    } else if (t_wall != TOI_NONE) {
+      ccd_advance(b, p_i, t_wall, body_v(b, p_i));
+      if (wall_n.x != 0.0) b->vx[p_i] *= -1;
+      else b->vy[p_i] *= -1;
+      ccd_rewind(b, p_i, t_wall);
+    } else {
+      return;
+    }
+  }
+}
+
+static void ccd_walk(Bodies *b, BHNode *node, BHNode *root, double dt,
+                     double reach)
+{
+  if (!node) return;
+  for (size_t n = 0; n < NUM_QUADS; n++) {
+    uint32_t body = node->bodies[n];
+    if (body != BH_NO_BODY && physics_is_fast(b, body, dt))
+      ccd_resolve_body(b, root, body, dt, reach);
+  }
+  for (size_t n = 0; n < MAX_CHILDREN; n++) {
+    ccd_walk(b, node->children[n], root, dt, reach);
+  }
+}
+
+// run before the position step, only fast bodies pay for sweeps
+void bhtree_apply_ccd(Bodies *b, BHNode *root, double dt) {
+  if (!root) return;
+  ccd_walk(b, root, root, dt, ccd_reach(b, root, dt));
+}
+
+void bhtree_apply_singular_gravity(Bodies *b, BHNode *node, Sink *sink) {
+  if (!node) return;
+  for (size_t n = 0; n < NUM_QUADS; n++) {
+    uint32_t body = node->bodies[n];
+    if (body != BH_NO_BODY) force_singular_gravity(b, body, sink);
   }
   if (node->is_partitioned) {
     for (size_t n = 0; n < MAX_CHILDREN; n++)
-      bhtree_apply_singular_gravity(node->children[n], sink_source);
+      bhtree_apply_singular_gravity(b, node->children[n], sink);
   }
 }
 
@@ -423,7 +603,8 @@ BHSystem new_bh_system(BHNode *tree) {
   va_end(args);
     
   force_fn *forces =
-    (force_fn *)arena_alloc(arena, forces_total * sizeof(force_fn));
+    (force_fn *)arena_alloc_tagged(arena, forces_total * sizeof(force_fn),
+                                   "bhtree forces");
 
   va_start(args, tree); 
     for (size_t i = 0; i < forces_total; i++) forces[i] = va_arg(args,force_fn);
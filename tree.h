@@ -8,6 +8,7 @@
 
 #define MAX_CHILDREN 4
 #define NUM_QUADS 4
+#define BH_NO_BODY UINT32_MAX  // an empty quadrant
 
 typedef enum {
   VERLET_POS = 1,
@@ -52,7 +53,8 @@ static inline Quad occ_to_quad(const OccState s) {
 
 typedef struct BHNode {
   struct BHNode *children[MAX_CHILDREN];
-  PhysicsEntity   *bodies[NUM_QUADS];
+  uint32_t         bodies[NUM_QUADS]; // indices into the store
+  struct BHNode   *lnodes[NUM_QUADS]; // least bounding node of each body
   bool is_partitioned;
   size_t body_total;  // total physical objects
   OccState occ_state; // maps to quadrants
@@ -67,20 +69,20 @@ static inline bool body_in_bounds(vec2 min, vec2 max, vec2 pos) {
 }
 
 typedef void BH_NODE_MAPPING;
-#define BH_NODE_MAP(FN, CODE)                                  \
-  BH_NODE_MAPPING FN(BHNode *node) {                           \
-    if (!node) return;                                         \
-    for (size_t n = 0; n < NUM_QUADS; n++) CODE                \
-    if (node->occ_state & OCC_SW) FN(node->children[QUAD_SW]); \
-    if (node->occ_state & OCC_NW) FN(node->children[QUAD_NW]); \
-    if (node->occ_state & OCC_NE) FN(node->children[QUAD_NE]); \
-    if (node->occ_state & OCC_SE) FN(node->children[QUAD_SE]); \
+#define BH_NODE_MAP(FN, CODE)                                     \
+  BH_NODE_MAPPING FN(Bodies *b, BHNode *node) {                   \
+    if (!node) return;                                            \
+    for (size_t n = 0; n < NUM_QUADS; n++) CODE                   \
+    if (node->occ_state & OCC_SW) FN(b, node->children[QUAD_SW]); \
+    if (node->occ_state & OCC_NW) FN(b, node->children[QUAD_NW]); \
+    if (node->occ_state & OCC_NE) FN(b, node->children[QUAD_NE]); \
+    if (node->occ_state & OCC_SE) FN(b, node->children[QUAD_SE]); \
 }                                                    
 
-BH_NODE_MAPPING bhtree_draw(BHNode *);
+BH_NODE_MAPPING bhtree_draw(Bodies *, BHNode *);
 BH_NODE_MAPPING bhtree_draw_quads(BHNode *, GLuint);
-BH_NODE_MAPPING bhtree_clear_forces(BHNode *);
-BH_NODE_MAPPING bhtree_apply_boundaries(BHNode *);
+BH_NODE_MAPPING bhtree_clear_forces(Bodies *, BHNode *);
+BH_NODE_MAPPING bhtree_apply_boundaries(Bodies *, BHNode *);
 
 #define EACH_QUAD(MIN, MAX, CODE) {                         \
   do {                                                      \
@@ -105,25 +107,38 @@ static inline bool bh_condition(BHNode *n1, BHNode *n2, double theta) {
 }
 
 BHNode *bhtree_create(MemoryArena *, vec2, vec2);
-BHNode *bhtree_init(size_t N, PhysicsEntity[static N], MemoryArena[static 1]);
+BHNode *bhtree_init(Bodies *, MemoryArena[static 1]);
 
-void bhtree_insert(MemoryArena *, BHNode *, PhysicsEntity *);
-void bhtree_integrate(integration_flag, BHNode *, double);
+void bhtree_insert(MemoryArena *, Bodies *, BHNode *, uint32_t);
+void bhtree_integrate(integration_flag, Bodies *, BHNode *, double);
+void bhtree_update_sleep(Bodies *, BHNode *, double);
+
+// what drawing a node needs, copied out so the render thread never walks
+// a tree the sim thread is rebuilding
+typedef struct { vec2 min, max, cm; } QuadBox;
+size_t bhtree_snapshot_quads(BHNode *, QuadBox *, size_t);
+void draw_quad_boxes(QuadBox *, size_t);
 
 typedef struct { vec2 nw, ne, sw, se; } BoundingBox;
 BoundingBox generate_bounding_box(vec2, double);
 void draw_bounding_box(BoundingBox, GLuint);
 
-#define bhtree_apply_collisions(N) _bhtree_apply_collisions(N, N)
-void _bhtree_apply_collisions(BHNode *node, BHNode *root);
-void bhtree_apply_singular_gravity(BHNode *, vec2);
+#define bhtree_apply_collisions(B, N) _bhtree_apply_collisions(B, N, N)
+void _bhtree_apply_collisions(Bodies *, BHNode *node, BHNode *root);
+void bhtree_for_each_pair(Bodies *, BHNode *, pair_fn, void *);
+void bhtree_apply_collisions_once(Bodies *, BHNode *);
+void bhtree_apply_singular_gravity(Bodies *, BHNode *, Sink *);
+void bhtree_apply_ccd(Bodies *, BHNode *, double);
 
+// nodes is scratch on the arena, release_collision_nodes hands it back
 typedef struct {
   size_t length;
   BHNode **nodes;
+  ArenaMarker mark;
 } BHNodeRef;
 
 BHNodeRef get_collision_nodes(MemoryArena[static 1], BHNode *, BoundingBox);
+void release_collision_nodes(MemoryArena[static 1], BHNodeRef *);
 void least_bounding_node(BHNode *, BHNode **, BoundingBox);
 
 #endif // TREE_H_